@@ -0,0 +1,106 @@
+#pragma once
+
+#include "broadcast_scheduler.hh"
+#include "channel.hh"
+#include "client.hh"
+#include "configurations.hh"
+#include "thread_pool.hh"
+#include "utilities.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Lifts the capacity limits and starts the pool and broadcast scheduler,
+ * call before the first ChannelManager/ClientManager access.
+ */
+inline void prepare_server() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    auto &config = ServerConfiguration::instance();
+    config.set_max_channels(1 << 20);
+    config.set_max_clients(1 << 20);
+    config.set_channel_members(1 << 20);
+    ThreadPool::initialize();
+    BroadcastScheduler::instance();
+  });
+}
+
+// Frame body as the reactor hands it to Request: id, type, payload, 2 NULs.
+inline std::vector<uint8_t> frame_body(int32_t id, PACKET_TYPE type,
+                                       std::string_view payload) {
+  std::vector<uint8_t> body(payload.size() + 10, 0);
+  std::memcpy(body.data(), &id, 4);
+  std::memcpy(body.data() + 4, &type, 4);
+  std::memcpy(body.data() + 8, payload.data(), payload.size());
+  return body;
+}
+
+// Blocks until the broadcast scheduler has drained the channel.
+inline void wait_idle(Channel &channel) {
+  std::unique_lock lock(channel.queueMutex);
+  channel.idle.wait(lock, [&channel]() { return !channel.scheduled; });
+}
+
+/* TCP clients backed by non-blocking socketpairs.
+ *
+ * There is no reactor in the benchmarks, so a background thread plays both
+ * the remote peers (reading everything the server writes) and the reactor's
+ * EPOLLOUT handling (flushing whatever queued up while the socket was full).
+ */
+class LoopbackClients {
+private:
+  std::mutex mtx;
+  std::vector<std::pair<std::shared_ptr<Client>, int>> peers;
+  std::atomic_bool stop{false};
+  std::thread drainer;
+
+  void drain() {
+    char sink[1 << 16];
+    while (!this->stop.load(std::memory_order_relaxed)) {
+      bool idle = true;
+      {
+        std::unique_lock lock(this->mtx);
+        for (auto &[client, remote] : this->peers) {
+          while (read(remote, sink, sizeof(sink)) > 0)
+            idle = false;
+          if (client->outbound_depth() > 0)
+            client->flush();
+        }
+      }
+      if (idle)
+        std::this_thread::yield();
+    }
+  }
+
+public:
+  static inline std::atomic_int next_id{1};
+
+  LoopbackClients() : drainer([this]() { this->drain(); }) {}
+
+  ~LoopbackClients() {
+    this->stop.store(true);
+    this->drainer.join();
+    for (auto &[client, remote] : this->peers)
+      close(remote);
+  }
+
+  // Returns a connected client whose socket is drained in the background.
+  std::shared_ptr<Client> open() {
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+    auto client = std::make_shared<Client>(pair[0], next_id.fetch_add(1));
+    client->set_connection(true);
+
+    std::unique_lock lock(this->mtx);
+    this->peers.emplace_back(client, pair[1]);
+    return client;
+  }
+};
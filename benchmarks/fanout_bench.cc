@@ -0,0 +1,128 @@
+#include "bench_support.hh"
+#include "channel.hh"
+#include "managers.hh"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/* One broadcast to `members` clients: encode, hand the channel to the
+ * scheduler and wait until every member's socket has been written.
+ */
+static void BM_QueueMessageFanout(benchmark::State &state) {
+  prepare_server();
+  auto &channels = ChannelManager::instance();
+  auto info = channels.create_channel("fanout", false);
+  uint32_t channel_id;
+  std::memcpy(&channel_id, info.data(), 4);
+  auto channel = channels.find_channel(channel_id);
+
+  LoopbackClients peers;
+  std::vector<std::shared_ptr<Client>> members;
+  for (int i = 0; i < state.range(0); i++) {
+    members.push_back(peers.open());
+    channel->join_channel(members.back());
+  }
+
+  std::string message(state.range(1), 'x');
+  for (auto _ : state) {
+    channel->queue_message(MessageView(members[0]->id, channel_id, 0, message));
+    wait_idle(*channel);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+
+  for (auto &member : members)
+    channel->leave_channel(member);
+  channels.remove_channel(channel_id);
+}
+BENCHMARK(BM_QueueMessageFanout)
+    ->ArgNames({"members", "bytes"})
+    ->ArgsProduct({{1, 8, 32, 256, 1024}, {16, 1024}})
+    ->UseRealTime();
+
+namespace {
+
+constexpr int REGISTERED = 1024;
+
+/* Clients registered once for the lookup benchmarks, their fds point at
+ * /dev/null so the ClientManager can close them at exit.
+ */
+std::vector<int> &registered_fds() {
+  static std::vector<int> fds = []() {
+    prepare_server();
+    std::vector<int> fds;
+    for (int i = 0; i < REGISTERED; i++) {
+      int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      ClientManager::instance().add_client(fd);
+      fds.push_back(fd);
+    }
+    return fds;
+  }();
+  return fds;
+}
+
+std::vector<uint32_t> &registered_channels() {
+  static std::vector<uint32_t> ids = []() {
+    prepare_server();
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < 64; i++) {
+      auto info = ChannelManager::instance().create_channel("lookup", false);
+      uint32_t id;
+      std::memcpy(&id, info.data(), 4);
+      ids.push_back(id);
+    }
+    return ids;
+  }();
+  return ids;
+}
+
+} // namespace
+
+static void BM_FindClient(benchmark::State &state) {
+  auto &fds = registered_fds();
+  auto &clients = ClientManager::instance();
+  size_t i = state.thread_index() * 97;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clients.find_by_fd(fds[i++ % fds.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindClient)->ThreadRange(1, 8)->UseRealTime();
+
+/* Lookups while thread 0 keeps connecting and disconnecting a client, which
+ * takes the manager's lock exclusively.
+ */
+static void BM_FindClientWithChurn(benchmark::State &state) {
+  auto &fds = registered_fds();
+  auto &clients = ClientManager::instance();
+  if (state.thread_index() == 0) {
+    for (auto _ : state) {
+      int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+      clients.remove_client(clients.add_client(fd)->id);
+    }
+    return;
+  }
+
+  size_t i = state.thread_index() * 97;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clients.find_by_fd(fds[i++ % fds.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindClientWithChurn)->ThreadRange(2, 8)->UseRealTime();
+
+static void BM_FindChannel(benchmark::State &state) {
+  auto &ids = registered_channels();
+  auto &channels = ChannelManager::instance();
+  size_t i = state.thread_index() * 7;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(channels.find_channel(ids[i++ % ids.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindChannel)->ThreadRange(1, 8)->UseRealTime();
@@ -0,0 +1,44 @@
+#include "message_log.hh"
+#include "utilities.hh"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/* Broadcasts appended over 16 channels, then synced: what one group
+ * commit costs per message at the given frame size.
+ */
+static void BM_LogAppend(benchmark::State &state) {
+  constexpr uint32_t CHANNELS = 16;
+  std::string dir =
+      (std::filesystem::temp_directory_path() / "relay-bench-XXXXXX").string();
+  if (mkdtemp(dir.data()) == nullptr) {
+    state.SkipWithError("mkdtemp failed");
+    return;
+  }
+
+  std::string text(state.range(0), 'x');
+  std::vector<int32_t> seqs(CHANNELS, 0);
+  {
+    MessageLog log(dir);
+    size_t batch = state.range(1);
+    for (auto _ : state) {
+      for (size_t i = 0; i < batch; i++) {
+        uint32_t channel = i % CHANNELS;
+        log.append(channel + 1,
+                   share(response(++seqs[channel], CH_MESSAGE, text)));
+      }
+      log.sync();
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+    state.SetBytesProcessed(state.iterations() * batch * (text.size() + 14));
+    state.counters["commits"] = log.stats().commits;
+  }
+  std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_LogAppend)
+    ->ArgNames({"bytes", "batch"})
+    ->ArgsProduct({{64, 1024}, {1, 256}})
+    ->UseRealTime();
@@ -0,0 +1,164 @@
+#include "bench_support.hh"
+#include "channel.hh"
+#include "managers.hh"
+#include "protocol.hh"
+#include "utilities.hh"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/* Process wide state shared by the handle_request benchmarks: one channel
+ * and one member client, set up once.
+ */
+struct World {
+  LoopbackClients peers;
+  std::shared_ptr<Client> member;
+  uint32_t channel_id;
+
+  World() {
+    prepare_server();
+    auto info = ChannelManager::instance().create_channel("bench", false);
+    std::memcpy(&this->channel_id, info.data(), 4);
+    this->member = this->peers.open();
+    auto join = this->frame_for(CH_JOIN);
+    Protocol::handle_request(this->member, Request(join));
+  }
+
+  // Frame body whose payload is the benchmark channel's id.
+  std::vector<uint8_t> frame_for(PACKET_TYPE type) const {
+    return frame_body(1, type, raw_bytes(this->channel_id));
+  }
+
+  static World &instance() {
+    static World world;
+    return world;
+  }
+};
+
+} // namespace
+
+static void BM_Response(benchmark::State &state) {
+  std::string payload(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(response(1, CH_MESSAGE, payload));
+  }
+  state.SetBytesProcessed(state.iterations() * (payload.size() + 14));
+}
+BENCHMARK(BM_Response)->Arg(0)->Arg(64)->Arg(1024)->Arg(16384);
+
+static void BM_RequestConstruction(benchmark::State &state) {
+  auto frame = frame_body(7, CH_MESSAGE, std::string(state.range(0), 'x'));
+  for (auto _ : state) {
+    Request request(frame);
+    benchmark::DoNotOptimize(request);
+  }
+}
+BENCHMARK(BM_RequestConstruction)->Arg(16)->Arg(1024);
+
+static void BM_Split(benchmark::State &state) {
+  std::string_view credentials = "a_long_username\nsecret_password";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(split(credentials, '\n'));
+  }
+}
+BENCHMARK(BM_Split);
+
+static void BM_I32FromLe(benchmark::State &state) {
+  uint8_t bytes[4] = {0x78, 0x56, 0x34, 0x12};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(bytes);
+    benchmark::DoNotOptimize(i32_from_le(bytes));
+  }
+}
+BENCHMARK(BM_I32FromLe);
+
+static void BM_HandleServerConnect(benchmark::State &state) {
+  auto &world = World::instance();
+  auto client = world.peers.open();
+  auto frame = frame_body(1, SVR_CONNECT, "bench\npassword");
+  for (auto _ : state) {
+    client->connected.store(false);
+    benchmark::DoNotOptimize(Protocol::handle_request(client, Request(frame)));
+  }
+  Protocol::server_disconnect(client);
+}
+BENCHMARK(BM_HandleServerConnect);
+
+// First page of the channel list with at least `channels` channels.
+static void BM_HandleChannelList(benchmark::State &state) {
+  auto &world = World::instance();
+  static int64_t listed = 1;
+  for (; listed < state.range(0); listed++)
+    ChannelManager::instance().create_channel("listed-channel", false);
+
+  auto frame = frame_body(1, CH_LIST, "");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Protocol::handle_request(world.member, Request(frame)));
+  }
+}
+BENCHMARK(BM_HandleChannelList)->Arg(1)->Arg(10000);
+
+static void BM_HandleChannelJoinLeave(benchmark::State &state) {
+  auto &world = World::instance();
+  auto client = world.peers.open();
+  auto join = world.frame_for(CH_JOIN);
+  auto leave = world.frame_for(CH_LEAVE);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Protocol::handle_request(client, Request(join)));
+    benchmark::DoNotOptimize(Protocol::handle_request(client, Request(leave)));
+  }
+}
+BENCHMARK(BM_HandleChannelJoinLeave);
+
+static void BM_HandleChannelMessage(benchmark::State &state) {
+  auto &world = World::instance();
+  std::string payload(8 + state.range(0), 'x');
+  std::memcpy(payload.data(), &world.channel_id, 4);
+  std::memset(payload.data() + 4, 0, 4);
+  auto frame = frame_body(1, CH_MESSAGE, payload);
+
+  auto channel = ChannelManager::instance().find_channel(world.channel_id);
+  size_t sent = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Protocol::handle_request(world.member, Request(frame)));
+    // keep the broadcast backlog (and the member's outbound queue) bounded
+    if (++sent % 256 == 0) {
+      state.PauseTiming();
+      wait_idle(*channel);
+      state.ResumeTiming();
+    }
+  }
+  wait_idle(*channel);
+}
+BENCHMARK(BM_HandleChannelMessage)->Arg(16)->Arg(512);
+
+static void BM_HandleChannelCreate(benchmark::State &state) {
+  auto &world = World::instance();
+  auto frame = frame_body(1, CH_CREATE, std::string("\0room", 5));
+  world.member->admin = true;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Protocol::handle_request(world.member, Request(frame)));
+  }
+  world.member->admin = false;
+}
+// every iteration leaves a channel behind, keep the count bounded
+BENCHMARK(BM_HandleChannelCreate)->Iterations(20000);
+
+static void BM_HandleUnknown(benchmark::State &state) {
+  auto &world = World::instance();
+  auto frame = frame_body(1, HEARTBEAT, "");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        Protocol::handle_request(world.member, Request(frame)));
+  }
+}
+BENCHMARK(BM_HandleUnknown);
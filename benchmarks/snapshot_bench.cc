@@ -0,0 +1,32 @@
+#include "snapshot.hh"
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <format>
+#include <vector>
+
+static std::vector<ChannelRecord> channels(size_t count) {
+  std::vector<ChannelRecord> records;
+  for (uint32_t id = 1; id <= count; id++)
+    records.push_back({id, id % 8 == 0, 1000, std::format("channel-{}", id),
+                       id % 4 == 0 ? "read the rules first" : ""});
+  return records;
+}
+
+// A whole channel directory encoded, as every --snapshot-interval.
+static void BM_SnapshotEncode(benchmark::State &state) {
+  auto records = channels(state.range(0));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Snapshot::encode(records));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SnapshotEncode)->Arg(10000)->Arg(50000);
+
+// Checksum and parse of the snapshot read on startup.
+static void BM_SnapshotDecode(benchmark::State &state) {
+  auto bytes = Snapshot::encode(channels(state.range(0)));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Snapshot::decode(bytes));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_SnapshotDecode)->Arg(10000)->Arg(50000);
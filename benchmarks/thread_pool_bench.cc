@@ -0,0 +1,114 @@
+#include "thread_pool.hh"
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int POOL_SIZE = 8;
+constexpr int TASKS_PER_ITERATION = 1 << 16;
+
+/* The pool this server used before the work-stealing one: a single
+ * std::queue<std::function> behind one mutex and condition variable.
+ */
+class MutexThreadPool {
+private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::atomic_bool stop{false};
+  std::vector<std::thread> threads;
+  std::queue<std::function<void()>> tasks;
+
+public:
+  explicit MutexThreadPool(int size) {
+    for (int t = 0; t < size; t++) {
+      this->threads.emplace_back([this]() {
+        while (true) {
+          std::function<void()> task;
+          {
+            std::unique_lock lock(this->mtx);
+            this->cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+
+            if (this->stop && this->tasks.empty())
+              return;
+
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+          }
+
+          task();
+        }
+      });
+    }
+  }
+
+  ~MutexThreadPool() {
+    {
+      std::unique_lock lock(this->mtx);
+      stop.exchange(true);
+    }
+    this->cv.notify_all();
+    for (auto &thread : this->threads) {
+      thread.join();
+    }
+  }
+
+  template <typename F> inline void enqueue(F &&f) {
+    {
+      std::unique_lock lock(this->mtx);
+      this->tasks.emplace(std::forward<F>(f));
+    }
+    this->cv.notify_one();
+  }
+};
+
+/* `producers` threads share TASKS_PER_ITERATION tiny tasks, the iteration
+ * ends once every task has run.
+ */
+template <typename Pool> void run_tasks(Pool &pool, int producers) {
+  std::atomic_int done{0};
+  std::vector<std::thread> threads;
+  int per_producer = TASKS_PER_ITERATION / producers;
+  int total = per_producer * producers;
+
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&pool, &done, per_producer]() {
+      for (int i = 0; i < per_producer; i++) {
+        pool.enqueue([&done]() { done.fetch_add(1); });
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  while (done.load() != total) {
+    std::this_thread::yield();
+  }
+}
+
+template <typename Pool> void BM_TaskThroughput(benchmark::State &state) {
+  Pool pool(POOL_SIZE);
+  int producers = static_cast<int>(state.range(0));
+  for (auto _ : state) {
+    run_tasks(pool, producers);
+  }
+  state.SetItemsProcessed(state.iterations() *
+                          (TASKS_PER_ITERATION / producers * producers));
+}
+
+} // namespace
+
+BENCHMARK(BM_TaskThroughput<MutexThreadPool>)
+    ->RangeMultiplier(2)
+    ->Range(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_TaskThroughput<ThreadPool>)
+    ->RangeMultiplier(2)
+    ->Range(1, 64)
+    ->UseRealTime();
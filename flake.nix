@@ -35,6 +35,7 @@
                 asio
                 boost
                 gtest
+                gbenchmark
                 spdlog
                 pkg-config
                 clang-tools
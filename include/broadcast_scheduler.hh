@@ -0,0 +1,45 @@
+#pragma once
+
+#include "configurations.hh"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Channel;
+
+/* Drains channel message queues on a fixed set of workers.
+ *
+ * A channel with pending messages is pushed once onto the ready queue (see
+ * `Channel::queue_message`), a worker pops it and sends at most
+ * BROADCAST_BATCH messages before putting it back at the tail. A channel is
+ * never in the ready queue twice, so its messages go out in order, and the
+ * number of threads does not depend on the number of channels.
+ */
+class BroadcastScheduler {
+private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::atomic_bool stop{false};
+  std::deque<Channel *> ready{};
+  std::vector<std::thread> workers;
+
+  BroadcastScheduler(int size);
+  void work();
+
+public:
+  BroadcastScheduler(const BroadcastScheduler &) = delete;
+  BroadcastScheduler &operator=(const BroadcastScheduler &) = delete;
+
+  ~BroadcastScheduler();
+
+  void schedule(Channel *channel);
+
+  static BroadcastScheduler &instance() {
+    static BroadcastScheduler scheduler(
+        ServerConfiguration::instance().broadcast_workers());
+    return scheduler;
+  }
+};
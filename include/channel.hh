@@ -1,5 +1,7 @@
 #pragma once
 
+#include "history.hh"
+#include "membership.hh"
 #include "typedef.hh"
 #include "utilities.hh"
 #include <atomic>
@@ -7,28 +9,32 @@
 #include <cstddef>
 #include <cstdint>
 #include <queue>
-#include <thread>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
 enum class JOINRESULT { SUCCESS = 0, BANNED, SECRET, FULL };
 enum class MODERATIONRESULT { SUCCESS, NOT_FOUND, UNAUTHORIZED };
 
+// Copy of a channel's listing fields, safe to use after the channel is gone.
 struct ChannelView {
   bool secret;
-  const uint32_t *id;
-  const std::string *name;
+  uint32_t id;
+  std::string name;
 
   ChannelView(Channel *channel);
 };
 
+// `message` points into the request frame, it is only valid until the
+// request has been handled.
 struct MessageView {
   const uint32_t sender_id;
   const uint32_t channel_id;
   const uint32_t reply_to;
-  const std::string message;
+  const std::string_view message;
 
   MessageView(uint32_t sender, uint32_t channel, uint32_t reply_to,
-              std::string message)
+              std::string_view message)
       : sender_id(sender), channel_id(channel), reply_to(reply_to),
         message(message) {}
 };
@@ -45,38 +51,71 @@ struct MessageView {
  * An invitation token is created by a moderator to send to a chatter.
  *
  * The invited chatter should send the token with the enter request.
+ *
+ * Members, bans and invitations are keyed by client id, so every membership
+ * check is a hash lookup instead of a scan over weak pointers.
  */
 class Channel {
 public:
   uint32_t id;
   std::mutex mtx;
   std::string name;
-  const size_t MAXCAPACITY{50};
+  const size_t MAXCAPACITY;
 
   std::atomic_int packetIds{1};
   std::atomic_bool secret{false};
 
   std::string pinnedMessage;
-  std::vector<int> banned{};
-  std::vector<int> invitations{};
-  std::vector<w_client> members{};
-  std::vector<w_client> moderators{};
-
+  std::unordered_set<uint32_t> banned{};
+  std::unordered_set<uint32_t> invitations{};
+  // Guarded by `mtx`, the authoritative member table.
+  Membership members{};
+  // What broadcasts fan out to, read without any lock (RCU style): joins
+  // and leaves copy the member handles into a new snapshot under `mtx` and
+  // swap it in, a broadcast worker loads the current one per batch and the
+  // old snapshot is freed once the last worker still sending from it is done.
+  std::atomic<std::shared_ptr<const Membership::Snapshot>> recipients{
+      std::make_shared<const Membership::Snapshot>()};
+
+  // Pending broadcasts, `scheduled` is true while the channel is owned by
+  // the BroadcastScheduler (queued or being drained).
   std::mutex queueMutex;
-  std::condition_variable cv;
-  std::queue<Response> messageQueue{};
-  std::thread messageQueueWorkerThread;
-  std::atomic_bool stopBroadcast{false};
+  std::condition_variable idle;
+  bool scheduled{false};
+  struct QueuedMessage {
+    shared_frame frame;
+    int64_t queued_at;
+  };
+  std::queue<QueuedMessage> messageQueue{};
+
+  // Last messages sent, for replay on join. A drain records its batch and
+  // loads `recipients` under `history_mtx`, a join queues what it missed
+  // and publishes the new member under it too.
+  std::mutex history_mtx;
+  History history;
+
+  // A CH_JOIN request, see History::last for what it asks to get back.
+  struct Replay {
+    int32_t request_id{-1};
+    size_t count{0};
+    uint32_t after{0};
+  };
 
   // utils
   ChannelView get_view();
   std::vector<char> info();
   bool is_moderator(const w_client &w_client); // *
 
+  void publish_members();
+  void send_join(const w_client &w_client, const Replay &replay);
   void queue_message(const MessageView view);
+  bool drain(size_t batch);
+  size_t queue_depth();
+  size_t history_bytes();
 
-  void leave_channel(const w_client &target_id);     // *
-  JOINRESULT join_channel(const w_client &w_client); // *
+  void leave_channel(const w_client &target_id); // *
+  JOINRESULT join_channel(const w_client &w_client,
+                          const Replay *replay = nullptr); // *
 
   MODERATIONRESULT change_privacy(const w_client &w_client);
   MODERATIONRESULT kick_member(const w_client &w_client, int target_id);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "utilities.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* The CH_LIST reply, kept encoded.
+ *
+ * Entries are kept sorted by channel id and cut into pages of at most
+ * PAGE_BYTES. Each page is encoded once into a shared frame and handed to
+ * every client that asks for it, until a change touches it: a create or a
+ * delete re-encodes the page it lands in and the ones after it (their
+ * boundaries moved), a privacy change only its own page. Pages are
+ * re-encoded lazily, by the first request after the change.
+ *
+ * Every page is stamped with the directory version it was encoded at, so a
+ * client that already holds that version of the page gets a short "not
+ * modified" reply instead.
+ */
+class ChannelDirectory {
+public:
+  // Bytes of entries per page.
+  static constexpr size_t PAGE_BYTES = 16 * 1024;
+  // version (4) | page (4) | last page flag (1)
+  static constexpr size_t PAGE_HEADER = 9;
+
+  struct Page {
+    uint32_t version;
+    // nullopt when the page doesn't exist
+    std::optional<shared_frame> frame;
+  };
+
+  void upsert(uint32_t id, bool secret, std::string_view name);
+  void erase(uint32_t id);
+  void set_secret(uint32_t id, bool secret);
+
+  // The encoded page `index`, its frame id is 0 since every request
+  // shares it.
+  Page page(size_t index);
+
+  inline uint32_t version() const {
+    return this->version_.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Entry {
+    uint32_t id;
+    bool secret;
+    std::string name;
+
+    inline size_t encoded_size() const { return 7 + this->name.size(); }
+  };
+
+  struct Encoded {
+    // index of the page's first entry and how many it holds
+    size_t start;
+    size_t count;
+    uint32_t version;
+    // empty when a change made it stale
+    shared_frame frame{};
+  };
+
+  std::mutex mtx_;
+  std::vector<Entry> entries_{};
+  std::vector<Encoded> pages_{};
+  std::atomic_uint32_t version_{1};
+
+  // Index of the page holding entry `at` (or the last one), `mtx_` held.
+  size_t page_of(size_t at) const;
+  // Drops the pages from the one holding entry `at` on, `mtx_` held.
+  void cut_from(size_t at);
+  // Pages the entries past the last page and re-encodes stale pages,
+  // `mtx_` held.
+  void encode();
+  void encode_page(size_t index);
+};
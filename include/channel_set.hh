@@ -0,0 +1,133 @@
+#pragma once
+
+#include "epoch.hh"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* The channels a client is in, read without a lock on every CH_MESSAGE.
+ *
+ * A published set is immutable: a join or a leave builds a new one and
+ * retires the old one to the epoch reclaimer, readers look it up under an
+ * Epoch::Guard. Up to FLAT_MAX channels the set is a sorted array. Past
+ * that it also carries an open addressed hash table kept at most half
+ * full, so lookups stay O(1) for clients in hundreds of channels.
+ *
+ * Writers must be serialized by the caller (Client::mtx).
+ */
+class ChannelSet {
+public:
+  static constexpr size_t FLAT_MAX = 16;
+
+private:
+  // channel ids start at 1, 0 marks an empty hash slot
+  static constexpr uint32_t EMPTY = 0;
+
+  struct Table {
+    std::vector<uint32_t> ids{};
+    std::vector<uint32_t> slots{};
+    int shift{32};
+
+    inline size_t home(uint32_t id) const {
+      return (id * 0x9E3779B1u) >> this->shift;
+    }
+
+    inline bool contains(uint32_t id) const {
+      if (this->slots.empty())
+        return std::binary_search(this->ids.begin(), this->ids.end(), id);
+
+      size_t mask = this->slots.size() - 1;
+      for (size_t i = this->home(id);; i = (i + 1) & mask) {
+        if (this->slots[i] == EMPTY)
+          return false;
+        if (this->slots[i] == id)
+          return true;
+      }
+    }
+  };
+
+  std::atomic<const Table *> table_{nullptr};
+
+  // Hashes the ids of a table that outgrew the flat array.
+  static inline void rehash(Table &table) {
+    if (table.ids.size() <= FLAT_MAX)
+      return;
+
+    size_t capacity = std::bit_ceil(table.ids.size() * 2);
+    table.shift = 32 - std::countr_zero(capacity);
+    table.slots.assign(capacity, EMPTY);
+    for (uint32_t id : table.ids) {
+      size_t i = table.home(id);
+      while (table.slots[i] != EMPTY)
+        i = (i + 1) & (capacity - 1);
+      table.slots[i] = id;
+    }
+  }
+
+  inline void publish(Table *updated) {
+    const Table *replaced = this->table_.load(std::memory_order_relaxed);
+    this->table_.store(updated, std::memory_order_seq_cst);
+    if (replaced != nullptr)
+      Epoch::retire([replaced] { delete replaced; });
+  }
+
+public:
+  ChannelSet() = default;
+  ChannelSet(const ChannelSet &) = delete;
+  ChannelSet &operator=(const ChannelSet &) = delete;
+
+  // The owner is gone, so is every reader.
+  ~ChannelSet() { delete this->table_.load(); }
+
+  inline bool contains(uint32_t id) const {
+    Epoch::Guard guard;
+    const Table *table = this->table_.load(std::memory_order_seq_cst);
+    return table != nullptr && table->contains(id);
+  }
+
+  // Returns false when the id was already in the set, or is no channel id.
+  inline bool insert(uint32_t id) {
+    if (id == EMPTY)
+      return false;
+    const Table *table = this->table_.load(std::memory_order_relaxed);
+    auto *updated = table != nullptr ? new Table{table->ids} : new Table();
+    auto at = std::lower_bound(updated->ids.begin(), updated->ids.end(), id);
+    if (at != updated->ids.end() && *at == id) {
+      delete updated;
+      return false;
+    }
+    updated->ids.insert(at, id);
+    rehash(*updated);
+    this->publish(updated);
+    return true;
+  }
+
+  // Returns false when the id wasn't in the set.
+  inline bool erase(uint32_t id) {
+    const Table *table = this->table_.load(std::memory_order_relaxed);
+    if (table == nullptr || !table->contains(id))
+      return false;
+    auto *updated = new Table{table->ids};
+    updated->ids.erase(
+        std::lower_bound(updated->ids.begin(), updated->ids.end(), id));
+    rehash(*updated);
+    this->publish(updated);
+    return true;
+  }
+
+  // Copy of the ids, in ascending order.
+  inline std::vector<uint32_t> ids() const {
+    Epoch::Guard guard;
+    const Table *table = this->table_.load(std::memory_order_seq_cst);
+    return table != nullptr ? table->ids : std::vector<uint32_t>();
+  }
+
+  inline size_t size() const {
+    Epoch::Guard guard;
+    const Table *table = this->table_.load(std::memory_order_seq_cst);
+    return table != nullptr ? table->ids.size() : 0;
+  }
+};
@@ -1,21 +1,29 @@
 #pragma once
 
+#include "channel_set.hh"
 #include "configurations.hh"
+#include "ring_buffer.hh"
 #include "spdlog/spdlog.h"
+#include "strand.hh"
 #include "typedef.hh"
 #include "utilities.hh"
 #include <atomic>
+#include <deque>
 #include <format>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unistd.h>
 #include <vector>
 
+class UringReactor;
+
 enum class ClientTransport { TCP, WBS };
 // Shared Pointer Tracker (Where a client shared_ptr can be found)
 // # Server
-//   -> client unordered map
+//   -> ClientManager slab
 // # Channel
 //   -> chatter vector
 //   -> moderator vector
@@ -23,33 +31,62 @@ enum class ClientTransport { TCP, WBS };
 class Client {
 public:
   int fd;
-  int id;
+  uint32_t id;
   std::mutex mtx;
   bool admin{false};
   std::string username;
   ClientTransport transport;
   std::optional<ws_handle> ws_hld;
-  std::vector<uint32_t> channels{};
+  websocket_server *ws_endpoint{nullptr};
+  // read lock-free by is_member, changed under `mtx`
+  ChannelSet channels{};
   std::atomic_bool connected{false};
+  // Wire format, v1 until SVR_CONNECT negotiates v2.
+  std::atomic<WIRE> wire{WIRE::V1};
+
+  // Requests from this connection run in order on this executor.
+  std::shared_ptr<Strand> strand{std::make_shared<Strand>()};
+  // Reader state, only touched by the reactor that owns the socket.
+  RingBuffer input{INPUT_BUFFER_SIZE};
+
+  // Writer state, frames wait here until the socket accepts them.
+  std::mutex out_mtx;
+  bool writable{true};
+  size_t out_offset{0};
+  std::deque<shared_frame> outbound{};
+  std::atomic_size_t out_depth{0};
+  // Set when the connection lives on an io_uring reactor, which does the
+  // writes itself; `flush_pending` avoids waking it once per frame.
+  UringReactor *uring{nullptr};
+  bool flush_pending{false};
+
+private:
+  bool flush_locked();
 
 public:
-  bool is_member(const int channel_id);
-  bool send_packet(const Response packet);
+  bool is_member(uint32_t channel_id) const;
+  bool send_packet(Response packet);
+  bool send_packet(const shared_frame &frame);
+  // Sends a frame already encoded in `wire`, which has to be this->wire.
+  bool send_encoded(const shared_frame &frame, WIRE wire);
+
+  bool flush();
+  inline size_t outbound_depth() const { return out_depth; }
 
   void set_connection(bool b);
-  void add_channel(const int channel_id);
-  void remove_channel(const int channel_id);
+  void add_channel(uint32_t channel_id);
+  void remove_channel(uint32_t channel_id);
 
-  void set_admin(const std::vector<uint8_t> password);
-  std::string change_username(const std::vector<uint8_t> username);
+  void set_admin(std::string_view password);
+  std::string change_username(std::string_view username);
 
-  explicit Client(int fd, int id)
+  explicit Client(int fd, uint32_t id)
       : fd(fd), id(id), username(std::format("user0{}", id)),
         transport(ClientTransport::TCP), ws_hld(std::nullopt) {}
 
-  explicit Client(int id, ws_handle hdl)
+  explicit Client(uint32_t id, ws_handle hdl, websocket_server *endpoint)
       : fd(-1), id(id), username(std::format("user0{}", id)),
-        transport(ClientTransport::WBS), ws_hld(hdl) {}
+        transport(ClientTransport::WBS), ws_hld(hdl), ws_endpoint(endpoint) {}
 
   ~Client() {
     if (this->fd != -1) {
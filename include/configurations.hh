@@ -1,10 +1,31 @@
 #pragma once
+#include <cstddef>
 #include <mutex>
 #include <string>
+#include <utility>
 
 constexpr int MIN_CHANNELS = 1;
 constexpr int MIN_CLIENTS = 10;
 constexpr int MIN_THREADS = 5;
+constexpr int MIN_REACTORS = 1;
+constexpr int MIN_BROADCASTERS = 2;
+constexpr int MIN_CHANNEL_MEMBERS = 50;
+// Messages a channel keeps for replay on join, 0 keeps none.
+constexpr int HISTORY_MESSAGES = 64;
+// What every channel's history may hold together.
+constexpr size_t HISTORY_BYTES = 64 * 1024 * 1024;
+// What a channel's history may hold even once HISTORY_BYTES is used up.
+constexpr size_t HISTORY_FLOOR_BYTES = 16 * 1024;
+// Seconds between snapshots of the channel directory, 0 takes none.
+constexpr int SNAPSHOT_INTERVAL = 30;
+// Messages a broadcast worker sends from one channel before moving on.
+constexpr int BROADCAST_BATCH = 32;
+// Initial size of a connection's input buffer, it grows for larger frames.
+constexpr int INPUT_BUFFER_SIZE = 4096;
+// Frames a client may have queued before it is dropped as a slow consumer.
+constexpr int MAX_OUTBOUND_FRAMES = 1024;
+
+enum class IOBACKEND { EPOLL, URING };
 
 /*
  * Returns the lowest value of two.
@@ -22,6 +43,15 @@ private:
   int max_clients_ = MIN_CLIENTS;
   int max_channels_ = MIN_CHANNELS;
   int thread_pool_size_ = MIN_THREADS;
+  int reactors_ = MIN_REACTORS;
+  int broadcast_workers_ = MIN_BROADCASTERS;
+  int channel_members_ = MIN_CHANNEL_MEMBERS;
+  int history_messages_ = HISTORY_MESSAGES;
+  size_t history_bytes_ = HISTORY_BYTES;
+  IOBACKEND io_backend_ = IOBACKEND::EPOLL;
+  // where the message log lives, empty keeps nothing on disk
+  std::string data_dir_{};
+  int snapshot_interval_ = SNAPSHOT_INTERVAL;
   std::string secret_password = "password";
   // mutable
   int active_users_ = 0;
@@ -61,6 +91,55 @@ public:
     }
   }
 
+  inline void set_reactors(int size) {
+    if (is_bigger(size, MIN_REACTORS)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      reactors_ = size;
+    }
+  }
+
+  inline void set_broadcast_workers(int size) {
+    if (is_bigger(size, MIN_BROADCASTERS)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      broadcast_workers_ = size;
+    }
+  }
+
+  inline void set_channel_members(int size) {
+    if (is_bigger(size, MIN_CHANNEL_MEMBERS)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      channel_members_ = size;
+    }
+  }
+
+  inline void set_history(int messages) {
+    if (messages >= 0) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      history_messages_ = messages;
+    }
+  }
+
+  inline void set_history_bytes(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    history_bytes_ = bytes;
+  }
+
+  inline void set_data_dir(std::string dir) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    data_dir_ = std::move(dir);
+  }
+
+  inline void set_snapshot_interval(int seconds) {
+    if (seconds >= 0) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      snapshot_interval_ = seconds;
+    }
+  }
+
+  inline void set_io_backend(IOBACKEND backend) {
+    this->io_backend_ = backend;
+  }
+
   inline void set_password(std::string secret) {
     this->secret_password = secret;
   }
@@ -72,4 +151,12 @@ public:
   inline int active_users() const { return active_users_; }
   inline int max_channels() const { return max_channels_; }
   inline int pool_size() const { return thread_pool_size_; }
+  inline int reactors() const { return reactors_; }
+  inline int broadcast_workers() const { return broadcast_workers_; }
+  inline int channel_members() const { return channel_members_; }
+  inline int history_messages() const { return history_messages_; }
+  inline size_t history_bytes() const { return history_bytes_; }
+  inline IOBACKEND io_backend() const { return io_backend_; }
+  inline const std::string &data_dir() const { return data_dir_; }
+  inline int snapshot_interval() const { return snapshot_interval_; }
 };
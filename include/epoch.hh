@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+/* Epoch based reclamation for read-mostly structures.
+ *
+ * Readers pin the current epoch in their thread's slot for as long as they
+ * hold raw pointers into the structure. Writers publish a new version, then
+ * retire the old one, which is freed once every slot is either idle or
+ * pinned at a later epoch, so no reader can still be looking at it.
+ *
+ * Pinning is a store to a cache line only this thread writes, readers never
+ * contend with each other or with writers.
+ */
+struct alignas(64) EpochSlot {
+  static constexpr uint64_t IDLE = std::numeric_limits<uint64_t>::max();
+
+  std::atomic_uint64_t epoch{IDLE};
+  std::atomic_bool in_use{true};
+  EpochSlot *next{nullptr};
+};
+
+class Epoch {
+private:
+  static inline std::atomic_uint64_t global_{0};
+  static inline thread_local EpochSlot *slot_ = nullptr;
+  static inline thread_local int depth_ = 0;
+
+  static EpochSlot *acquire_slot();
+
+  static inline void enter() {
+    if (depth_++ > 0)
+      return;
+    if (slot_ == nullptr)
+      slot_ = acquire_slot();
+    // seq_cst so the pin is visible before any pointer is read
+    slot_->epoch.store(global_.load(std::memory_order_acquire),
+                       std::memory_order_seq_cst);
+  }
+
+  static inline void exit() {
+    if (--depth_ == 0)
+      slot_->epoch.store(EpochSlot::IDLE, std::memory_order_release);
+  }
+
+public:
+  // Keeps whatever the thread reads while it is alive from being freed.
+  class Guard {
+  public:
+    Guard() { Epoch::enter(); }
+    ~Guard() { Epoch::exit(); }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+  };
+
+  // Runs `deleter` on the reclaimer thread once no reader pinned before
+  // this call is left. The new version must already be published (with a
+  // seq_cst store).
+  static void retire(std::function<void()> deleter);
+};
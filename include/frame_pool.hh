@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/* Pooled buffer holding one encoded frame, the bytes follow the header.
+ *
+ * Buffers come in a few size classes, from acks up to MAX_FRAME_SIZE. Bigger
+ * ones are allocated on their own and never pooled.
+ */
+struct FrameBuffer {
+  std::atomic_int refs{1};
+  uint32_t length{0};
+  uint32_t capacity{0};
+  uint8_t size_class{0};
+  FrameBuffer *next{nullptr};
+
+  inline char *data() { return reinterpret_cast<char *>(this + 1); }
+  inline const char *data() const {
+    return reinterpret_cast<const char *>(this + 1);
+  }
+  inline size_t size() const { return this->length; }
+};
+
+/* Reference counted handle to a FrameBuffer, the buffer goes back to the
+ * pool when the last handle is dropped (usually once the send completes).
+ */
+class Frame {
+private:
+  FrameBuffer *buffer_{nullptr};
+
+public:
+  Frame() = default;
+  explicit Frame(FrameBuffer *buffer) : buffer_(buffer) {}
+
+  Frame(const Frame &other) : buffer_(other.buffer_) {
+    if (this->buffer_ != nullptr)
+      this->buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Frame(Frame &&other) noexcept
+      : buffer_(std::exchange(other.buffer_, nullptr)) {}
+
+  Frame &operator=(Frame other) noexcept {
+    std::swap(this->buffer_, other.buffer_);
+    return *this;
+  }
+
+  ~Frame() { this->reset(); }
+
+  void reset();
+
+  inline FrameBuffer *get() const { return this->buffer_; }
+  inline const FrameBuffer *operator->() const { return this->buffer_; }
+  inline explicit operator bool() const { return this->buffer_ != nullptr; }
+};
+
+/* Size-classed frame buffer pool.
+ *
+ * Every thread keeps a small free list per class. A thread that mostly
+ * releases (the one finishing the sends) hands batches over to a shared
+ * depot, and a thread that mostly allocates (the one encoding broadcasts)
+ * refills from it, so the heap is only hit when the pool runs dry.
+ */
+class FramePool {
+public:
+  static constexpr size_t CLASSES = 6;
+  static constexpr size_t CLASS_SIZES[CLASSES] = {64,   256,   1024,
+                                                  4096, 16384, 65552};
+
+  struct Stats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t oversized;
+  };
+
+  // Returns a buffer of at least `size` bytes, with size() set to `size`.
+  static Frame acquire(size_t size);
+  static void release(FrameBuffer *buffer);
+
+  static Stats stats();
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* Log-linear (HDR style) buckets for nanosecond latencies: values below 16
+ * are exact, above that every power of two is split in 16, so a bucket's
+ * midpoint is within ~3% of any value it holds.
+ */
+struct HistogramBuckets {
+  static constexpr int SUB_BITS = 4;
+  static constexpr uint64_t SUB = 1 << SUB_BITS;
+  static constexpr size_t COUNT = 64 * SUB;
+
+  static inline size_t index(uint64_t value) {
+    if (value < SUB)
+      return value;
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return (shift + 1) * SUB + ((value >> shift) & (SUB - 1));
+  }
+
+  static inline uint64_t midpoint(size_t index) {
+    if (index < SUB)
+      return index;
+    int shift = index / SUB - 1;
+    return ((SUB + index % SUB) << shift) + ((1ULL << shift) >> 1);
+  }
+};
+
+/* Single writer histogram, merged from per-thread copies before reading.
+ */
+class Histogram {
+private:
+  std::vector<uint64_t> counts_ =
+      std::vector<uint64_t>(HistogramBuckets::COUNT, 0);
+  uint64_t total_{0};
+  uint64_t sum_{0};
+  uint64_t max_{0};
+
+public:
+  inline void record(uint64_t value) {
+    this->counts_[HistogramBuckets::index(value)]++;
+    this->total_++;
+    this->sum_ += value;
+    this->max_ = std::max(this->max_, value);
+  }
+
+  // Adds `count` values that fell in bucket `index`.
+  inline void add(size_t index, uint64_t count) {
+    this->counts_[index] += count;
+    this->total_ += count;
+  }
+
+  inline void add_sum(uint64_t sum, uint64_t max) {
+    this->sum_ += sum;
+    this->max_ = std::max(this->max_, max);
+  }
+
+  inline void merge(const Histogram &other) {
+    for (size_t i = 0; i < this->counts_.size(); i++)
+      this->counts_[i] += other.counts_[i];
+    this->total_ += other.total_;
+    this->sum_ += other.sum_;
+    this->max_ = std::max(this->max_, other.max_);
+  }
+
+  inline uint64_t percentile(double q) const {
+    uint64_t rank = std::max<uint64_t>(1, q * this->total_ + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < this->counts_.size(); i++) {
+      seen += this->counts_[i];
+      if (seen >= rank)
+        return std::min(HistogramBuckets::midpoint(i), this->max_);
+    }
+    return this->max_;
+  }
+
+  // Values recorded in bucket `index`.
+  inline uint64_t bucket(size_t index) const { return this->counts_[index]; }
+
+  inline uint64_t count() const { return this->total_; }
+  inline uint64_t sum() const { return this->sum_; }
+  inline uint64_t max() const { return this->max_; }
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "configurations.hh"
+#include "utilities.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* A channel's last messages, kept encoded for replay on join.
+ *
+ * A fixed ring of handles to the frames that were broadcast, recording
+ * doesn't copy the message. Entries are keyed by the frame's id, the
+ * channel's packetIds sequence, which grows in recording order. Every
+ * channel's frames count against one global byte budget (--history-bytes):
+ * a channel that would go over it drops its own oldest messages first, down
+ * to HISTORY_FLOOR_BYTES. Every channel may keep that much even when busier
+ * channels used up the budget, so the total stays under the budget plus one
+ * floor per channel.
+ *
+ * Not synchronized, the owning channel guards it.
+ */
+class History {
+private:
+  struct Entry {
+    uint32_t seq;
+    shared_frame frame;
+  };
+
+  static inline std::atomic_size_t total_bytes_{0};
+
+  std::vector<Entry> ring_;
+  // index of the oldest entry
+  size_t head_{0};
+  size_t size_{0};
+  size_t bytes_{0};
+
+  // i-th oldest entry
+  inline const Entry &at(size_t i) const {
+    return this->ring_[(this->head_ + i) % this->ring_.size()];
+  }
+
+  inline void drop_oldest() {
+    auto &oldest = this->ring_[this->head_];
+    this->bytes_ -= oldest.frame->size();
+    total_bytes_.fetch_sub(oldest.frame->size(), std::memory_order_relaxed);
+    oldest.frame = {};
+    this->head_ = (this->head_ + 1) % this->ring_.size();
+    this->size_--;
+  }
+
+public:
+  explicit History(size_t capacity) : ring_(capacity) {}
+  History(const History &) = delete;
+  History &operator=(const History &) = delete;
+
+  ~History() {
+    total_bytes_.fetch_sub(this->bytes_, std::memory_order_relaxed);
+  }
+
+  inline void record(const shared_frame &frame) {
+    if (this->ring_.empty())
+      return;
+    if (this->size_ == this->ring_.size())
+      this->drop_oldest();
+
+    const size_t size = frame->size();
+    const size_t budget = ServerConfiguration::instance().history_bytes();
+    while (total_bytes_.fetch_add(size, std::memory_order_relaxed) + size >
+               budget &&
+           this->bytes_ + size > HISTORY_FLOOR_BYTES) {
+      total_bytes_.fetch_sub(size, std::memory_order_relaxed);
+      if (this->size_ == 0)
+        return;
+      this->drop_oldest();
+    }
+
+    uint32_t seq;
+    std::memcpy(&seq, frame->data() + 4, sizeof(seq));
+    auto &entry = this->ring_[(this->head_ + this->size_) % this->ring_.size()];
+    entry = {seq, frame};
+    this->size_++;
+    this->bytes_ += size;
+  }
+
+  // The last `count` messages sent after message `after`, oldest first.
+  inline std::vector<shared_frame> last(size_t count,
+                                        uint32_t after = 0) const {
+    size_t first = this->size_;
+    while (first > 0 && this->size_ - first < count &&
+           this->at(first - 1).seq > after)
+      first--;
+
+    std::vector<shared_frame> frames;
+    frames.reserve(this->size_ - first);
+    for (size_t i = first; i < this->size_; i++)
+      frames.push_back(this->at(i).frame);
+    return frames;
+  }
+
+  inline size_t size() const { return this->size_; }
+  inline size_t bytes() const { return this->bytes_; }
+  static inline size_t total_bytes() {
+    return total_bytes_.load(std::memory_order_relaxed);
+  }
+};
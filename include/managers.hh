@@ -1,26 +1,58 @@
 #pragma once
 
 #include "channel.hh"
+#include "channel_directory.hh"
 #include "configurations.hh"
+#include "epoch.hh"
+#include "snapshot.hh"
 #include "typedef.hh"
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <optional>
+#include <mutex>
 #include <shared_mutex>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+// Keeps a channel alive while it is in use, even if it gets removed.
+using ChannelHandle = std::shared_ptr<Channel>;
+
+/* Channel table split in SHARDS shards by id.
+ *
+ * Each shard publishes an immutable map that lookups read without a lock or
+ * a reference count, under an Epoch::Guard. Creating or removing a channel
+ * copies its shard's map under the shard's write mutex, which only
+ * serializes writers of that shard, and retires the old map to the epoch
+ * reclaimer. Lookups hand out reference counted handles, so a removed
+ * channel is destroyed once the last request using it is done with it.
+ */
 class ChannelManager {
 public:
+  static constexpr size_t SHARDS = 16;
+
   bool has_capacity();
   void remove_channel(uint32_t i);
   std::vector<ChannelView> get_views();
+  // (channel id, pending broadcasts) for every channel.
+  std::vector<std::pair<uint32_t, size_t>> queue_depths();
+  // (channel id, bytes held by its history) for every channel.
+  std::vector<std::pair<uint32_t, size_t>> history_bytes();
 
-  Channel *find_channel(uint32_t i) const;
+  ChannelHandle find_channel(uint32_t i) const;
+  // The encoded CH_LIST reply, kept up to date with the table.
+  inline ChannelDirectory &directory() { return this->directory_; }
 
   std::vector<char> create_channel(std::string name, bool secret);
+  // Channels created from now on get ids above `last`.
+  void reserve_ids(uint32_t last);
+
+  // What a snapshot keeps of every channel, by id.
+  std::vector<ChannelRecord> records();
+  // Adds the channels of a snapshot, each shard's map is copied once.
+  // Returns how many were added, ids already in use are skipped.
+  size_t restore(const std::vector<ChannelRecord> &records);
 
   ChannelManager(const ChannelManager &) = delete;
   ChannelManager &operator=(ChannelManager &) = delete;
@@ -33,26 +65,66 @@ public:
 
 private:
   ChannelManager(int max) : MAXCHANNELS(max) {};
+  ~ChannelManager();
+
+private:
+  using Table = std::unordered_map<uint32_t, ChannelHandle>;
+
+  struct alignas(64) Shard {
+    std::mutex write_mtx;
+    std::atomic<const Table *> table{new Table()};
+  };
+
+  inline Shard &shard_of(uint32_t id) { return this->shards_[id % SHARDS]; }
+  inline const Shard &shard_of(uint32_t id) const {
+    return this->shards_[id % SHARDS];
+  }
+
+  // Publishes `updated` under write_mtx, returns the map it replaced.
+  static const Table *replace_table(Shard &shard, const Table *updated);
+  // Frees a replaced map once no lookup can still be reading it. Called
+  // outside write_mtx, it may destroy the channels it held.
+  static void retire_table(const Table *table);
+
+  // Every channel in every shard, each shard read from one snapshot.
+  std::vector<ChannelHandle> all_channels() const;
 
 private:
-  std::shared_mutex mutex;
   const size_t MAXCHANNELS;
   std::atomic_int channel_id_tracker_{1};
-  std::unordered_map<uint32_t, std::unique_ptr<Channel>> channels;
+  std::atomic_size_t count_{0};
+  Shard shards_[SHARDS];
+  ChannelDirectory directory_{};
 };
 
+// Keeps a client alive while a request or send still uses it.
+using ClientHandle = std::shared_ptr<Client>;
+
+/* Every session, TCP and WebSocket, in one slab.
+ *
+ * A client id is its slot in the slab plus the slot's generation in the top
+ * bits. Freeing a slot bumps its generation, so an id kept by a channel or
+ * a queued request stops resolving once the slot is reused. Lookups by id
+ * index the slab, lookups by fd go through a table indexed by fd and
+ * WebSocket handles through a hash of the connection's address, all O(1).
+ */
 class ClientManager {
 public:
+  static constexpr uint32_t SLOT_BITS = 20;
+  static constexpr uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1;
+
   bool has_capacity();
 
-  int add_client(int fd);
-  int add_client(ws_handle hdl);
+  ClientHandle add_client(int fd);
+  ClientHandle add_client(ws_handle hdl, websocket_server *endpoint);
 
-  void remove_client(uint32_t fd);
-  void remove_client(ws_handle &hdl);
+  void remove_client(uint32_t id);
 
-  std::optional<std::shared_ptr<Client>> find_client(uint32_t fd) const;
-  std::optional<std::shared_ptr<Client>> find_client(ws_handle &hdl) const;
+  size_t size() const;
+
+  ClientHandle find_client(uint32_t id) const;
+  ClientHandle find_by_fd(int fd) const;
+  ClientHandle find_client(ws_handle &hdl) const;
 
   ClientManager(const ClientManager &) = delete;
   ClientManager &operator=(const ClientManager &) = delete;
@@ -65,11 +137,27 @@ public:
 private:
   ClientManager(int max) : MAXCLIENTS(max) {};
 
+private:
+  struct Session {
+    ClientHandle client{};
+    uint32_t generation{0};
+    // address of the WebSocket connection, the key in `ws_ids_`
+    const void *ws_key{nullptr};
+  };
+
+  // Takes a free slot and returns the id it gets, under the unique lock.
+  uint32_t allocate();
+  static inline uint32_t slot_of(uint32_t id) { return id & SLOT_MASK; }
+  static inline const void *ws_key(ws_handle &hdl) { return hdl.lock().get(); }
+
 private:
   const size_t MAXCLIENTS;
-  std::shared_mutex mutex;
-  std::atomic_int clientIds{1};
-  std::unordered_map<uint32_t, std::shared_ptr<Client>> tcp_clients_{};
-  std::map<ws_handle, std::shared_ptr<Client>, std::owner_less<ws_handle>>
-      ws_clients_{};
+  mutable std::shared_mutex mutex;
+  // slot 0 is never handed out, so no client has id 0
+  std::vector<Session> slab_ = std::vector<Session>(1);
+  std::vector<uint32_t> free_{};
+  // fd -> client id, 0 when the fd isn't a client
+  std::vector<uint32_t> fds_{};
+  std::unordered_map<const void *, uint32_t> ws_ids_{};
+  size_t count_{0};
 };
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "typedef.hh"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+/* Channel members keyed by client id (a slot map).
+ *
+ * Members live in dense parallel arrays, so a broadcast walks one contiguous
+ * array of handles. `slots_` maps a client id to its dense index, and
+ * removing a member moves the last one into the hole, so lookups, joins and
+ * leaves are O(1) whatever the channel size.
+ */
+class Membership {
+private:
+  std::vector<uint32_t> ids_{};
+  std::vector<w_client> handles_{};
+  std::vector<bool> moderators_{};
+  std::unordered_map<uint32_t, uint32_t> slots_{};
+
+public:
+  inline size_t size() const { return this->ids_.size(); }
+  inline bool empty() const { return this->ids_.empty(); }
+
+  inline bool contains(uint32_t id) const {
+    return this->slots_.contains(id);
+  }
+
+  // Returns false when the client is already a member.
+  inline bool add(uint32_t id, const w_client &handle) {
+    auto [slot, added] = this->slots_.try_emplace(id, this->ids_.size());
+    if (!added)
+      return false;
+    this->ids_.push_back(id);
+    this->handles_.push_back(handle);
+    this->moderators_.push_back(false);
+    return true;
+  }
+
+  // Returns false when the client wasn't a member.
+  inline bool remove(uint32_t id) {
+    auto find = this->slots_.find(id);
+    if (find == this->slots_.end())
+      return false;
+
+    uint32_t slot = find->second;
+    uint32_t last = this->ids_.size() - 1;
+    if (slot != last) {
+      this->ids_[slot] = this->ids_[last];
+      this->handles_[slot] = std::move(this->handles_[last]);
+      this->moderators_[slot] = this->moderators_[last];
+      this->slots_[this->ids_[slot]] = slot;
+    }
+    this->ids_.pop_back();
+    this->handles_.pop_back();
+    this->moderators_.pop_back();
+    this->slots_.erase(find);
+    return true;
+  }
+
+  inline std::optional<w_client> find(uint32_t id) const {
+    auto find = this->slots_.find(id);
+    if (find == this->slots_.end())
+      return std::nullopt;
+    return this->handles_[find->second];
+  }
+
+  inline bool is_moderator(uint32_t id) const {
+    auto find = this->slots_.find(id);
+    return find != this->slots_.end() && this->moderators_[find->second];
+  }
+
+  // Returns false when the client isn't a member.
+  inline bool set_moderator(uint32_t id, bool moderator) {
+    auto find = this->slots_.find(id);
+    if (find == this->slots_.end())
+      return false;
+    this->moderators_[find->second] = moderator;
+    return true;
+  }
+
+  inline std::span<const uint32_t> ids() const { return this->ids_; }
+  inline std::span<const w_client> handles() const { return this->handles_; }
+
+  // Immutable copy of the send handles, see Channel::recipients.
+  using Snapshot = std::vector<w_client>;
+  inline std::shared_ptr<const Snapshot> snapshot() const {
+    return std::make_shared<const Snapshot>(this->handles_.begin(),
+                                            this->handles_.end());
+  }
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "utilities.hh"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Durable, append-only log of every channel's broadcasts (--data-dir).
+ *
+ * Each channel has a directory of segments: `<first id>.log` holds the
+ * frames back to back exactly as they were broadcast, `<first id>.idx` one
+ * (id, offset, CRC32C) entry per frame. Both files are sized up front
+ * (sparse) and mapped, so an append is a memcpy and a range read is a binary
+ * search over the mapped index. A full segment is trimmed to what it holds
+ * and closed, and the next one starts; reads map sealed segments on demand.
+ *
+ * append() only queues a reference to the frame, it never touches the
+ * disk. A background writer takes everything queued so far, copies it into
+ * the segments and syncs each touched segment once for the whole group,
+ * data before index (group commit). Readers only see synced entries, and a
+ * crash loses at most the group being written.
+ */
+class MessageLog {
+public:
+  static constexpr size_t SEGMENT_BYTES = 16 * 1024 * 1024;
+  // Queued bytes past which append() drops frames instead of waiting.
+  static constexpr size_t MAX_PENDING_BYTES = 256 * 1024 * 1024;
+
+  struct Stats {
+    uint64_t appended;
+    uint64_t dropped;
+    uint64_t commits;
+    uint64_t pending_bytes;
+  };
+
+  // Opens the log in `dir`, creating it if needed, and recovers what the
+  // segments hold.
+  explicit MessageLog(std::filesystem::path dir,
+                      size_t segment_bytes = SEGMENT_BYTES);
+  // Writes and syncs whatever is queued.
+  ~MessageLog();
+
+  MessageLog(const MessageLog &) = delete;
+  MessageLog &operator=(const MessageLog &) = delete;
+
+  // Queues a broadcast of `channel`, a channel's frames must come in id
+  // order. Returns false when the writer is too far behind.
+  bool append(uint32_t channel, const shared_frame &frame);
+
+  // Blocks until everything appended before the call is durable.
+  void sync();
+
+  // Up to `count` durable frames of `channel` with an id above `after`,
+  // oldest first.
+  std::vector<shared_frame> read(uint32_t channel, uint32_t after,
+                                 size_t count) const;
+
+  // Id of the last durable frame of `channel`, 0 when there is none.
+  uint32_t last_id(uint32_t channel) const;
+
+  // Highest channel id with a log, 0 when there is none.
+  uint32_t last_channel() const;
+
+  Stats stats() const;
+
+  // The server's log, nullptr unless --data-dir is set.
+  static MessageLog *instance();
+
+private:
+  struct Segment;
+  struct ChannelLog;
+
+  struct Pending {
+    uint32_t channel;
+    shared_frame frame;
+  };
+
+  const std::filesystem::path dir_;
+  const size_t segment_bytes_;
+
+  mutable std::mutex channels_mtx_;
+  std::unordered_map<uint32_t, std::shared_ptr<ChannelLog>> channels_{};
+
+  mutable std::mutex pending_mtx_;
+  std::condition_variable pending_cv_;
+  std::condition_variable synced_cv_;
+  std::vector<Pending> pending_{};
+  size_t pending_bytes_{0};
+  uint64_t queued_{0};
+  uint64_t written_{0};
+  bool stop_{false};
+
+  std::atomic_uint64_t appended_{0};
+  std::atomic_uint64_t dropped_{0};
+  std::atomic_uint64_t commits_{0};
+
+  std::thread writer_;
+
+  void recover();
+  ChannelLog &channel_log(uint32_t channel);
+  // Copies the frame into the channel's open segment, starting a new one
+  // when it is full. Returns the segment written to.
+  Segment *write(uint32_t channel, const shared_frame &frame);
+  void write_loop();
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "histogram.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class COUNTER : uint8_t {
+  BYTES_IN,
+  BYTES_OUT,
+  ACCEPTED,
+  REJECTED,
+  SEND_FAILURES,
+  COUNT
+};
+
+/* Request pipeline stages, each gets a latency histogram.
+ * - WAKEUP : epoll/io_uring wakeup to the start of the connection's read
+ * - HANDLE : frame parsed to handle_request return (strand + pool queueing
+ *            included)
+ * - QUEUE  : queue_message to the broadcast worker dequeuing the message
+ * - SEND   : dequeue to send_packet returning for the last member
+ */
+enum class STAGE : uint8_t { WAKEUP, HANDLE, QUEUE, SEND, COUNT };
+
+/* One thread's counters. Only the owning thread writes them, so an increment
+ * is a relaxed load and store with no lock prefix, and the alignment keeps
+ * two threads' shards off each other's cache lines.
+ */
+struct alignas(64) MetricShard {
+  static constexpr size_t TYPES = 256;
+  static constexpr size_t STAGES = static_cast<size_t>(STAGE::COUNT);
+
+  std::atomic_uint64_t packets_in[TYPES]{};
+  std::atomic_uint64_t packets_out[TYPES]{};
+  std::atomic_uint64_t counters[static_cast<size_t>(COUNTER::COUNT)]{};
+  std::atomic_uint64_t latency[STAGES][HistogramBuckets::COUNT]{};
+  std::atomic_uint64_t latency_sum[STAGES]{};
+  std::atomic_uint64_t latency_max[STAGES]{};
+  MetricShard *next{nullptr};
+};
+
+/* Process wide runtime metrics.
+ *
+ * Counters are per-thread shards, registered on a lock-free list the first
+ * time a thread counts something and never freed, so totals survive threads
+ * that exit. Reading sums every shard. Gauges (queue depths, connections)
+ * are sampled from their owners when the metrics are read, the message path
+ * never touches them.
+ */
+class Metrics {
+private:
+  static inline thread_local MetricShard *shard_ = nullptr;
+
+  static MetricShard *register_shard();
+
+  static inline MetricShard &local() {
+    if (shard_ == nullptr)
+      shard_ = register_shard();
+    return *shard_;
+  }
+
+  static inline void add(std::atomic_uint64_t &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+public:
+  static inline void packet_in(uint32_t type, size_t bytes) {
+    auto &shard = local();
+    add(shard.packets_in[type % MetricShard::TYPES], 1);
+    add(shard.counters[static_cast<size_t>(COUNTER::BYTES_IN)], bytes);
+  }
+
+  static inline void packet_out(uint32_t type, size_t bytes) {
+    auto &shard = local();
+    add(shard.packets_out[type % MetricShard::TYPES], 1);
+    add(shard.counters[static_cast<size_t>(COUNTER::BYTES_OUT)], bytes);
+  }
+
+  static inline void count(COUNTER counter, uint64_t n = 1) {
+    add(local().counters[static_cast<size_t>(counter)], n);
+  }
+
+  // Monotonic timestamp for the stage timings.
+  static inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Records the time spent in `stage`, both ends are now() values.
+  static inline void record(STAGE stage, int64_t started,
+                            int64_t finished = now()) {
+    auto elapsed =
+        static_cast<uint64_t>(std::max<int64_t>(finished - started, 0));
+    auto s = static_cast<size_t>(stage);
+    auto &shard = local();
+    add(shard.latency[s][HistogramBuckets::index(elapsed)], 1);
+    add(shard.latency_sum[s], elapsed);
+    if (elapsed > shard.latency_max[s].load(std::memory_order_relaxed))
+      shard.latency_max[s].store(elapsed, std::memory_order_relaxed);
+  }
+
+  struct Totals {
+    uint64_t packets_in[MetricShard::TYPES]{};
+    uint64_t packets_out[MetricShard::TYPES]{};
+    uint64_t counters[static_cast<size_t>(COUNTER::COUNT)]{};
+    Histogram stages[MetricShard::STAGES]{};
+
+    inline uint64_t operator[](COUNTER counter) const {
+      return this->counters[static_cast<size_t>(counter)];
+    }
+    inline const Histogram &operator[](STAGE stage) const {
+      return this->stages[static_cast<size_t>(stage)];
+    }
+  };
+
+  static Totals totals();
+
+  // Counters and gauges in the Prometheus text format.
+  static std::string render();
+};
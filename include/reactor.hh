@@ -0,0 +1,63 @@
+#pragma once
+
+#include "client.hh"
+#include <memory>
+#include <sys/epoll.h>
+#include <thread>
+#include <vector>
+
+/* A reactor owns one I/O event loop and one SO_REUSEPORT listening socket.
+ *
+ * The kernel spreads new connections across every reactor's listening socket
+ * and a connection stays on the reactor that accepted it for its whole
+ * lifetime, so reactors never share their event loop and never need a lock
+ * to (re)arm one of their file descriptors.
+ *
+ * Backends (epoll, io_uring) only move bytes, framing and dispatching to the
+ * client's strand is shared here.
+ */
+class Reactor {
+protected:
+  int id_;
+  int listen_fd_;
+  std::thread thread_;
+
+  static int open_listener(int id, int port);
+
+  std::shared_ptr<Client> admit(int fd);
+  int parse_incoming(const std::shared_ptr<Client> &client);
+  void release(const std::shared_ptr<Client> &client);
+
+public:
+  Reactor(const Reactor &) = delete;
+  Reactor &operator=(const Reactor &) = delete;
+
+  Reactor(int id, int port) : id_(id), listen_fd_(open_listener(id, port)) {}
+  virtual ~Reactor();
+
+  virtual void run() = 0;
+  void start();
+  void join();
+};
+
+/* Readiness based backend: edge triggered epoll, the reactor thread reads
+ * with readv and senders write straight to the socket until EAGAIN.
+ */
+class EpollReactor : public Reactor {
+private:
+  int epoll_fd_;
+  // Clients accepted here, by fd. Only the reactor thread touches it, so an
+  // event finds its client without a lock or a reference count.
+  std::vector<std::shared_ptr<Client>> clients_{};
+
+  int read_incoming(const std::shared_ptr<Client> &client);
+
+  void accept_connections();
+  void disconnect(int fd);
+
+public:
+  EpollReactor(int id, int port);
+  ~EpollReactor() override;
+
+  void run() override;
+};
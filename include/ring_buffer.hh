@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+/* Byte ring used as a per-connection input buffer.
+ *
+ * `head_` and `tail_` grow monotonically and are masked on access, so the
+ * capacity is always a power of two. Storage is only allocated on first use
+ * and grows when a frame larger than the current capacity is announced.
+ */
+class RingBuffer {
+private:
+  size_t head_{0};
+  size_t tail_{0};
+  size_t initial_;
+  std::vector<uint8_t> buffer_;
+
+  inline size_t mask() const { return this->buffer_.size() - 1; }
+
+  static constexpr size_t round_up(size_t n) {
+    size_t capacity = 1;
+    while (capacity < n)
+      capacity <<= 1;
+    return capacity;
+  }
+
+public:
+  explicit RingBuffer(size_t capacity) : initial_(round_up(capacity)) {}
+
+  inline size_t size() const { return this->tail_ - this->head_; }
+  inline bool empty() const { return this->tail_ == this->head_; }
+  inline size_t capacity() const { return this->buffer_.size(); }
+  inline size_t available() const { return this->capacity() - this->size(); }
+
+  /* Free space as (at most) two contiguous regions, ready for readv.
+   */
+  inline std::array<std::span<uint8_t>, 2> writable() {
+    if (this->buffer_.empty())
+      this->buffer_.resize(this->initial_);
+
+    size_t free = this->available();
+    size_t start = this->tail_ & this->mask();
+    size_t first = std::min(free, this->capacity() - start);
+    return {std::span<uint8_t>(this->buffer_.data() + start, first),
+            std::span<uint8_t>(this->buffer_.data(), free - first)};
+  }
+
+  inline void commit(size_t n) { this->tail_ += n; }
+  inline void consume(size_t n) { this->head_ += n; }
+
+  /* Copies `n` readable bytes starting `offset` bytes past the head.
+   */
+  inline void peek(void *dst, size_t n, size_t offset = 0) const {
+    size_t start = (this->head_ + offset) & this->mask();
+    size_t first = std::min(n, this->capacity() - start);
+    auto *out = static_cast<uint8_t *>(dst);
+    std::memcpy(out, this->buffer_.data() + start, first);
+    std::memcpy(out + first, this->buffer_.data(), n - first);
+  }
+
+  /* Makes room for at least `n` buffered bytes, keeping what is unread.
+   */
+  inline void reserve(size_t n) {
+    if (n <= this->capacity())
+      return;
+
+    std::vector<uint8_t> grown(round_up(std::max(n, this->initial_)));
+    size_t used = this->size();
+    if (!this->buffer_.empty())
+      this->peek(grown.data(), used);
+    this->buffer_.swap(grown);
+    this->head_ = 0;
+    this->tail_ = used;
+  }
+};
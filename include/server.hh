@@ -1,81 +1,76 @@
 #pragma once
 
-#include "client.hh"
+#include "broadcast_scheduler.hh"
 #include "configurations.hh"
 #include "managers.hh"
-#include "protocol.hh"
+#include "message_log.hh"
+#include "snapshot.hh"
+#include "reactor.hh"
 #include "spdlog/spdlog.h"
 #include "thread_pool.hh"
-#include <arpa/inet.h>
-#include <cstdlib>
+#include "uring_reactor.hh"
+#include <chrono>
 #include <memory>
-#include <netinet/in.h>
-#include <shared_mutex>
-#include <sys/epoll.h>
-#include <sys/socket.h>
-#include <unistd.h>
+#include <vector>
 
+/* Front end of the TCP server.
+ *
+ * Owns `reactors` event loops, each one with its own epoll instance (or
+ * io_uring, see --io) and its own SO_REUSEPORT socket bound to the
+ * configured port.
+ */
 class Server : public std::enable_shared_from_this<Server> {
 private:
-  int epoll_fd_;
-  int server_fd_;
-  std::shared_mutex epoll_mtx_;
+  std::vector<std::unique_ptr<Reactor>> reactors_;
 
-  std::shared_ptr<ClientManager> clients;
-  std::shared_ptr<ChannelManager> channels;
-
-  int read_size(w_client pointer); // *
-  void disconnect(const w_client &w_client);
-  int read_incoming(std::shared_ptr<Client> client);
+  // io_uring when requested and supported by the kernel, epoll otherwise
+  static std::unique_ptr<Reactor> make_reactor(int id,
+                                               ServerConfiguration &config) {
+    if (config.io_backend() == IOBACKEND::URING) {
+      if (auto reactor = UringReactor::create(id, config.port())) {
+        return reactor;
+      }
+      spdlog::warn("io_uring unavailable, reactor {0} falls back to epoll",
+                   id);
+    }
+    return std::make_unique<EpollReactor>(id, config.port());
+  }
 
 public:
   Server() {
     auto &config = ServerConfiguration::instance();
 
-    // global thread pool first access
-    ThreadPool::initialize();
-    this->server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-
-    if (this->server_fd_ == -1) {
-      spdlog::error("could not create server socket.");
-      exit(1);
+    // opened before the broadcast workers so it outlives them, new
+    // channels take ids past the ones it already has logs for
+    if (auto *log = MessageLog::instance()) {
+      ChannelManager::instance().reserve_ids(log->last_channel());
+      spdlog::info("message log in {0}", config.data_dir());
     }
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(config.port());
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-    if (bind(this->server_fd_, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-      spdlog::error("unable to bind server to given address: {0}",
-                    config.port());
-      close(this->server_fd_);
-      exit(2);
+    // channels are back before the first connection is accepted
+    if (auto *snapshot = Snapshot::instance()) {
+      auto started = std::chrono::steady_clock::now();
+      size_t restored = snapshot->load();
+      spdlog::info("restored {0} channels in {1}ms", restored,
+                   std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - started)
+                       .count());
     }
 
-    if (::listen(this->server_fd_, SOMAXCONN) == -1) {
-      spdlog::error("socket failed to listen on bound address");
-      close(this->server_fd_);
-      exit(3);
+    // global thread pool and broadcast workers first access
+    ThreadPool::initialize();
+    BroadcastScheduler::instance();
+    for (int i = 0; i < config.reactors(); i++) {
+      this->reactors_.push_back(make_reactor(i, config));
     }
 
-    epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.fd = this->server_fd_;
-    this->epoll_fd_ = epoll_create1(0);
-    epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, this->server_fd_, &ev);
-
     spdlog::info("server setup complete");
     spdlog::info("listening on port {0}", config.port());
+    spdlog::info("reactor count {0}", config.reactors());
     spdlog::info("thread pool size {0}", config.pool_size());
+    spdlog::info("broadcast workers {0}", config.broadcast_workers());
     spdlog::info("max clients allowed {0}", config.max_clients());
     spdlog::info("max channels allowed {0}", config.max_channels());
   }
 
-  ~Server() {
-    close(this->epoll_fd_);
-    close(this->server_fd_);
-  }
-
   void listen();
 };
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What a snapshot keeps of a channel.
+struct ChannelRecord {
+  uint32_t id;
+  bool secret;
+  // the channel's packetIds, so message ids go on where they left off
+  int32_t next_seq;
+  std::string name;
+  std::string pinned;
+};
+
+/* Binary snapshots of the channel directory (--data-dir).
+ *
+ * Layout, little endian:
+ *   magic (4) | version (4) | count (4)
+ *   count x [ id (4) | secret (1) | next_seq (4) | name length (2) |
+ *             pinned length (4) | name | pinned ]
+ *   FNV-1a 64 of everything before it (8)
+ *
+ * A snapshot is written to a temporary file, synced and renamed over the
+ * previous one, so a reader finds either the old or the new snapshot whole.
+ * A background thread takes one every --snapshot-interval seconds, and
+ * skips the write when nothing changed since the last one.
+ */
+class Snapshot {
+public:
+  static constexpr uint32_t MAGIC = 0x50414e53; // "SNAP"
+  static constexpr uint32_t VERSION = 1;
+  static constexpr const char *FILE_NAME = "channels.snap";
+
+  static std::vector<char> encode(std::span<const ChannelRecord> records);
+  // nullopt when the bytes aren't a whole snapshot of this version.
+  static std::optional<std::vector<ChannelRecord>>
+  decode(std::span<const char> bytes);
+
+  // Replaces `file` with `bytes` atomically.
+  static bool write(const std::filesystem::path &file,
+                    std::span<const char> bytes);
+  // nullopt when there is no file or it doesn't decode.
+  static std::optional<std::vector<ChannelRecord>>
+  read(const std::filesystem::path &file);
+
+  explicit Snapshot(std::filesystem::path dir, std::chrono::seconds interval);
+  ~Snapshot();
+
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  // Restores the last snapshot into the ChannelManager, returns how many
+  // channels came back.
+  size_t load();
+  // Takes a snapshot now, returns false if it couldn't be written.
+  bool save();
+
+  // The server's snapshots, nullptr unless --data-dir is set.
+  static Snapshot *instance();
+
+private:
+  const std::filesystem::path file_;
+  const std::chrono::seconds interval_;
+
+  // serializes save(), holds what was last written
+  std::mutex save_mtx_;
+  std::vector<char> last_{};
+
+  std::mutex stop_mtx_;
+  std::condition_variable stop_cv_;
+  bool stop_{false};
+  std::thread thread_;
+};
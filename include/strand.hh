@@ -0,0 +1,68 @@
+#pragma once
+
+#include "thread_pool.hh"
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+/* Serial executor on top of the global ThreadPool.
+ *
+ * Tasks posted to the same strand run one at a time and in posting order,
+ * on whichever worker picks the strand up. Different strands run in
+ * parallel. A strand with work is in the pool at most once (`running`), and
+ * after STRAND_BATCH tasks it goes back to the pool so a busy connection
+ * can't hold a worker forever.
+ */
+class Strand : public std::enable_shared_from_this<Strand> {
+private:
+  static constexpr int STRAND_BATCH = 16;
+
+  std::mutex mtx;
+  bool running{false};
+  std::deque<Task> tasks{};
+
+  inline void schedule() {
+    ThreadPool::initialize().enqueue(
+        [self = this->shared_from_this()]() { self->run(); });
+  }
+
+  inline void run() {
+    Task task;
+    for (int i = 0; i < STRAND_BATCH; i++) {
+      {
+        std::unique_lock lock(this->mtx);
+        if (this->tasks.empty()) {
+          this->running = false;
+          return;
+        }
+        task = std::move(this->tasks.front());
+        this->tasks.pop_front();
+      }
+      task();
+      task.reset();
+    }
+    this->schedule();
+  }
+
+public:
+  template <typename F> inline void post(F &&f) {
+    bool idle;
+    {
+      std::unique_lock lock(this->mtx);
+      this->tasks.emplace_back(std::forward<F>(f));
+      idle = !this->running;
+      this->running = true;
+    }
+
+    if (idle) {
+      this->schedule();
+    }
+  }
+
+  inline size_t backlog() {
+    std::unique_lock lock(this->mtx);
+    return this->tasks.size();
+  }
+};
@@ -2,40 +2,325 @@
 
 #include "configurations.hh"
 #include <atomic>
-#include <condition_variable>
-#include <functional>
-#include <mutex>
-#include <queue>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
+
+/* Type-erased callable stored inline, creating or moving a task never
+ * allocates. Captures have to fit in Task::CAPACITY bytes, which is checked
+ * at compile time.
+ */
+class Task {
+public:
+  static constexpr size_t CAPACITY = 48;
+
+private:
+  struct Ops {
+    void (*invoke)(void *);
+    void (*relocate)(void *dst, void *src);
+    void (*destroy)(void *);
+  };
+
+  template <typename F>
+  static constexpr Ops ops_for{
+      [](void *f) { (*static_cast<F *>(f))(); },
+      [](void *dst, void *src) {
+        new (dst) F(std::move(*static_cast<F *>(src)));
+        static_cast<F *>(src)->~F();
+      },
+      [](void *f) { static_cast<F *>(f)->~F(); }};
+
+  alignas(std::max_align_t) unsigned char storage_[CAPACITY];
+  const Ops *ops_{nullptr};
+
+public:
+  Task() = default;
+
+  template <typename F, typename Fn = std::decay_t<F>>
+    requires(!std::is_same_v<Fn, Task>)
+  Task(F &&f) {
+    static_assert(sizeof(Fn) <= CAPACITY, "task captures do not fit inline");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t));
+    new (this->storage_) Fn(std::forward<F>(f));
+    this->ops_ = &ops_for<Fn>;
+  }
+
+  Task(Task &&other) noexcept { *this = std::move(other); }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      this->reset();
+      if (other.ops_ != nullptr) {
+        other.ops_->relocate(this->storage_, other.storage_);
+        this->ops_ = std::exchange(other.ops_, nullptr);
+      }
+    }
+    return *this;
+  }
+
+  ~Task() { this->reset(); }
+
+  inline void reset() {
+    if (this->ops_ != nullptr) {
+      this->ops_->destroy(this->storage_);
+      this->ops_ = nullptr;
+    }
+  }
+
+  inline void operator()() { this->ops_->invoke(this->storage_); }
+};
+
+/* Bounded lock-free multi-producer multi-consumer queue (Vyukov), used to
+ * inject tasks from threads that are not pool workers.
+ */
+class InjectionQueue {
+private:
+  struct Slot {
+    std::atomic_size_t sequence;
+    Task task;
+  };
+
+  size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic_size_t head_{0};
+  alignas(64) std::atomic_size_t tail_{0};
+
+public:
+  explicit InjectionQueue(size_t capacity)
+      : mask_(capacity - 1), slots_(new Slot[capacity]) {
+    for (size_t i = 0; i < capacity; i++) {
+      this->slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Moves `task` into the queue, returns false (task untouched) when full.
+  inline bool push(Task &task) {
+    size_t pos = this->tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = this->slots_[pos & this->mask_];
+      size_t seq = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (this->tail_.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          slot.task = std::move(task);
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = this->tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  inline bool pop(Task &out) {
+    size_t pos = this->head_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = this->slots_[pos & this->mask_];
+      size_t seq = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (this->head_.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          out = std::move(slot.task);
+          slot.sequence.store(pos + this->mask_ + 1,
+                              std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = this->head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // An estimate. head_ never passes tail_, so it is read first, but relaxed
+  // loads may still see a head_ newer than the tail_: that counts as empty.
+  inline size_t size() const {
+    size_t head = this->head_.load(std::memory_order_relaxed);
+    size_t tail = this->tail_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+};
+
+/* Per-worker deque. The owner pushes and pops at the back, idle workers
+ * steal from the front. Guarded by a spinlock that is only contended while
+ * a steal is in progress.
+ */
+class alignas(64) WorkerQueue {
+private:
+  static constexpr size_t CAPACITY = 256;
+
+  size_t head_{0};
+  size_t tail_{0};
+  std::atomic_flag lock_;
+  std::unique_ptr<Task[]> ring_{new Task[CAPACITY]};
+
+  inline void lock() {
+    while (this->lock_.test_and_set(std::memory_order_acquire)) {
+      while (this->lock_.test(std::memory_order_relaxed))
+        std::this_thread::yield();
+    }
+  }
+
+  inline void unlock() { this->lock_.clear(std::memory_order_release); }
+
+public:
+  inline bool push(Task &task) {
+    this->lock();
+    bool pushed = this->tail_ - this->head_ < CAPACITY;
+    if (pushed) {
+      this->ring_[this->tail_++ % CAPACITY] = std::move(task);
+    }
+    this->unlock();
+    return pushed;
+  }
+
+  inline bool pop(Task &out) {
+    this->lock();
+    bool popped = this->tail_ != this->head_;
+    if (popped) {
+      out = std::move(this->ring_[--this->tail_ % CAPACITY]);
+    }
+    this->unlock();
+    return popped;
+  }
+
+  inline bool steal(Task &out) {
+    this->lock();
+    bool stolen = this->tail_ != this->head_;
+    if (stolen) {
+      out = std::move(this->ring_[this->head_++ % CAPACITY]);
+    }
+    this->unlock();
+    return stolen;
+  }
+
+  inline size_t size() {
+    this->lock();
+    size_t size = this->tail_ - this->head_;
+    this->unlock();
+    return size;
+  }
+};
+
+/* Work-stealing pool.
+ *
+ * Tasks enqueued from a worker go to that worker's own deque, tasks from any
+ * other thread go through the lock-free injection queue. Idle workers steal
+ * from their siblings before parking on `epoch`. The destructor lets the
+ * workers finish what is queued and joins them.
+ */
 class ThreadPool {
 private:
-  std::mutex mtx;
-  std::condition_variable cv;
+  static constexpr size_t INJECTION_CAPACITY = 16384;
+  static constexpr int SPIN_ROUNDS = 16;
+
   std::atomic_bool stop{false};
+  std::atomic_int sleepers{0};
+  std::atomic_int searching{0};
+  std::atomic_uint32_t epoch{0};
+  InjectionQueue injection{INJECTION_CAPACITY};
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
   std::vector<std::thread> threads;
-  std::queue<std::function<void()>> tasks;
 
-  ThreadPool(int size) {
-    for (int t = 0; t < size; t++) {
-      this->threads.emplace_back([this]() {
-        while (true) {
-          std::function<void()> task;
-          {
-            std::unique_lock lock(this->mtx);
-            this->cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+  static inline thread_local ThreadPool *current = nullptr;
+  static inline thread_local size_t worker_index = 0;
 
-            if (this->stop && this->tasks.empty())
-              return;
+  inline bool find_task(size_t self, Task &task) {
+    if (this->queues[self]->pop(task) || this->injection.pop(task))
+      return true;
 
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
-          }
+    // start stealing right after ourselves so victims are spread out
+    size_t size = this->queues.size();
+    for (size_t i = 1; i < size; i++) {
+      if (this->queues[(self + i) % size]->steal(task))
+        return true;
+    }
+    return false;
+  }
 
-          task();
-        }
-      });
+  inline void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->sleepers.load(std::memory_order_relaxed) > 0) {
+      this->epoch.fetch_add(1, std::memory_order_release);
+      this->epoch.notify_one();
+    }
+  }
+
+  // A worker that is still searching will find the new task on its own (or
+  // recheck before parking), so only pay for a futex wake when none is.
+  inline void wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->searching.load(std::memory_order_relaxed) == 0)
+      this->notify();
+  }
+
+  // The last searcher to find a task wakes a sleeper in its place, which
+  // searches in turn. A burst that wake() left to a spinning worker spreads
+  // over the pool this way, and the chain stops at a worker that finds
+  // nothing.
+  inline void stop_searching(bool found) {
+    if (this->searching.fetch_sub(1) == 1 && found)
+      this->notify();
+  }
+
+  inline bool spin(size_t self, Task &task) {
+    this->searching.fetch_add(1);
+    bool found = false;
+    for (int i = 0; i < SPIN_ROUNDS && !found; i++) {
+      std::this_thread::yield();
+      found = this->find_task(self, task);
+    }
+    this->stop_searching(found);
+    return found;
+  }
+
+  inline void work(size_t self) {
+    current = this;
+    worker_index = self;
+    Task task;
+    // a worker woken from the futex searches until it finds a task or
+    // goes back to sleep
+    bool woken = false;
+    while (true) {
+      bool found = this->find_task(self, task) || this->spin(self, task);
+      if (std::exchange(woken, false))
+        this->stop_searching(found);
+      if (found) {
+        task();
+        task.reset();
+        continue;
+      }
+
+      // announce we are going to sleep, then look once more so a task
+      // pushed in between is never missed
+      this->sleepers.fetch_add(1);
+      uint32_t seen = this->epoch.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (this->find_task(self, task)) {
+        this->sleepers.fetch_sub(1);
+        task();
+        task.reset();
+        continue;
+      }
+
+      if (this->stop) {
+        this->sleepers.fetch_sub(1);
+        return;
+      }
+      this->epoch.wait(seen, std::memory_order_acquire);
+      this->searching.fetch_add(1);
+      this->sleepers.fetch_sub(1);
+      woken = true;
     }
   }
 
@@ -43,20 +328,53 @@ public:
   ThreadPool(const ThreadPool &) = delete;
   ThreadPool &operator=(const ThreadPool &) = delete;
 
+  explicit ThreadPool(int size) {
+    for (int t = 0; t < size; t++) {
+      this->queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (int t = 0; t < size; t++) {
+      this->threads.emplace_back([this, t]() { this->work(t); });
+    }
+  }
+
   ~ThreadPool() {
-    {
-      std::unique_lock lock(this->mtx);
-      stop.exchange(true);
+    this->stop.exchange(true);
+    this->epoch.fetch_add(1);
+    this->epoch.notify_all();
+
+    for (auto &thread : this->threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
     }
-    this->cv.notify_all();
   }
 
+  /* A worker that finds both its deque and the injection queue full runs
+   * the task itself: every worker could be stuck here otherwise, with
+   * nobody left to drain the queues. Other threads wait for room.
+   */
   template <typename F> inline void enqueue(F &&f) {
-    {
-      std::unique_lock lock(this->mtx);
-      this->tasks.emplace(std::forward<F>(f));
+    Task task(std::forward<F>(f));
+    if (current == this) {
+      if (!this->queues[worker_index]->push(task) &&
+          !this->injection.push(task)) {
+        task();
+        return;
+      }
+    } else {
+      while (!this->injection.push(task)) {
+        std::this_thread::yield();
+      }
     }
-    this->cv.notify_one();
+    this->wake();
+  }
+
+  // Tasks waiting in the injection queue and every worker's deque.
+  inline size_t queued() const {
+    size_t queued = this->injection.size();
+    for (auto &queue : this->queues)
+      queued += queue->size();
+    return queued;
   }
 
   static ThreadPool &initialize() {
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "client.hh"
+#include "reactor.hh"
+#include "utilities.hh"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+/* Completion based backend built on io_uring (raw syscalls, no liburing).
+ *
+ * - one multishot accept on the reactor's listening socket
+ * - one multishot recv per connection, filled from a provided buffer ring
+ * - sends are submitted by the reactor thread only: strands queue frames on
+ *   the client and wake the reactor through an eventfd, the reactor then
+ *   coalesces up to SEND_BATCH frames per sendmsg, large single frames go
+ *   out with SEND_ZC
+ *
+ * Everything is submitted with a single io_uring_enter per loop iteration.
+ */
+class UringReactor : public Reactor {
+private:
+  static constexpr unsigned RING_ENTRIES = 1024;
+  static constexpr unsigned BUFFER_COUNT = 256;
+  static constexpr unsigned BUFFER_SIZE = 4096;
+  static constexpr uint16_t BUFFER_GROUP = 0;
+  static constexpr size_t SEND_BATCH = 64;
+  static constexpr size_t SEND_ZC_THRESHOLD = 16 * 1024;
+
+  enum class OP : uint8_t { ACCEPT = 1, RECV, SEND, SEND_ZC, WAKE };
+
+  struct Connection {
+    std::shared_ptr<Client> client;
+    // operations whose last completion (no IORING_CQE_F_MORE) is pending
+    int inflight{0};
+    bool sending{false};
+    bool closing{false};
+    size_t sent_offset{0};
+    std::vector<shared_frame> frames{};
+    // SEND_ZC buffers stay alive until their notification completes
+    std::deque<shared_frame> zc_hold{};
+    iovec iov[SEND_BATCH];
+    msghdr msg{};
+  };
+
+  int ring_fd_{-1};
+  int wake_fd_{-1};
+  uint64_t wake_value_{0};
+
+  // submission and completion queues, mapped from the ring fd
+  void *sq_ptr_{nullptr};
+  void *cq_ptr_{nullptr};
+  size_t sq_size_{0};
+  size_t cq_size_{0};
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_sqe *sqes_{nullptr};
+  io_uring_cqe *cqes_{nullptr};
+  unsigned sq_entries_{0};
+  // tail of the SQEs filled so far, only next_sqe() advances it and submit()
+  // publishes it as the kernel's sq tail
+  unsigned sqe_tail_{0};
+
+  // provided buffer ring shared by every multishot recv
+  io_uring_buf_ring *buf_ring_{nullptr};
+  std::vector<uint8_t> buffers_{};
+  uint16_t buf_tail_{0};
+
+  std::unordered_map<int, std::unique_ptr<Connection>> connections_{};
+
+  std::mutex flush_mtx_;
+  std::vector<int> flush_requests_{};
+
+  explicit UringReactor(int id, int port) : Reactor(id, port) {}
+  bool setup();
+
+  io_uring_sqe *next_sqe();
+  int submit(unsigned wait);
+  void recycle_buffer(uint16_t bid);
+
+  void arm_accept();
+  void arm_wake();
+  void arm_recv(int fd);
+  void start_send(Connection &conn);
+  void submit_frames(Connection &conn);
+  void close_connection(Connection &conn);
+
+  void on_accept(const io_uring_cqe &cqe);
+  void on_recv(Connection &conn, const io_uring_cqe &cqe);
+  void on_send(Connection &conn, const io_uring_cqe &cqe, bool zero_copy);
+  void on_wake();
+
+public:
+  ~UringReactor() override;
+
+  // Returns nullptr when the kernel lacks the features this backend needs.
+  static std::unique_ptr<UringReactor> create(int id, int port);
+
+  void request_flush(int fd);
+  void run() override;
+};
@@ -1,15 +1,31 @@
 #pragma once
 
+#include "frame_pool.hh"
+#include "ring_buffer.hh"
 #include <concepts>
 #include <cstdint>
 #include <cstring>
+#include <memory>
+#include <span>
 #include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
 #include <sys/types.h>
+#include <type_traits>
 #include <vector>
 
 class Channel;
 
-int i32_from_le(const std::vector<uint8_t> &bytes);
+/* Reads a little endian i32 from the first 4 bytes of `bytes`.
+ */
+inline int i32_from_le(std::span<const uint8_t> bytes) {
+  return static_cast<int>(bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+                          bytes[3] << 24);
+}
+
+inline std::string_view as_text(std::span<const uint8_t> bytes) {
+  return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+}
 
 enum class PACKET_TYPE : uint32_t {
   // If any of these fails they will have an ID of -1 and a reason payload.
@@ -28,6 +44,9 @@ enum class PACKET_TYPE : uint32_t {
   // client -> server : attempt to shutdown server
   // server -> client : server has been shutdown.
   SVR_SHUTDOWN = 0x05,
+  // client -> server : request the server's runtime metrics (admin only)
+  // server -> client : metrics in the Prometheus text format
+  SVR_STATS = 0x06,
   // client -> server : attempt to join the channel
   // server -> client : a client has connected to the channel.
   CH_JOIN = 0x10,
@@ -50,6 +69,11 @@ enum class PACKET_TYPE : uint32_t {
   // client -> server : request channel list.
   // server -> client : list of channels
   CH_LIST = 0x16,
+  // client -> server : several messages in one request.
+  // server -> client : one status byte per message.
+  CH_MESSAGE_BATCH = 0x17,
+  // server -> client : several CH_MESSAGE broadcasts, frames back to back.
+  CH_MESSAGE_BUNDLE = 0x18,
   // client -> server : attempt to invite
   // server -> client : channel invitation
   CH_INVITE = 0x20,
@@ -87,6 +111,7 @@ constexpr auto SVR_DISCONNECT = PACKET_TYPE::SVR_DISCONNECT;
 constexpr auto SVR_MESSAGE = PACKET_TYPE::SVR_MESSAGE;
 constexpr auto SVR_BANNED = PACKET_TYPE::SVR_BANNED;
 constexpr auto SVR_SHUTDOWN = PACKET_TYPE::SVR_SHUTDOWN;
+constexpr auto SVR_STATS = PACKET_TYPE::SVR_STATS;
 
 constexpr auto CH_JOIN = PACKET_TYPE::CH_JOIN;
 constexpr auto CH_LEAVE = PACKET_TYPE::CH_LEAVE;
@@ -95,6 +120,8 @@ constexpr auto CH_UPDATE = PACKET_TYPE::CH_UPDATE;
 constexpr auto CH_DELETE = PACKET_TYPE::CH_DELETE;
 constexpr auto CH_CREATE = PACKET_TYPE::CH_CREATE;
 constexpr auto CH_LIST = PACKET_TYPE::CH_LIST;
+constexpr auto CH_MESSAGE_BATCH = PACKET_TYPE::CH_MESSAGE_BATCH;
+constexpr auto CH_MESSAGE_BUNDLE = PACKET_TYPE::CH_MESSAGE_BUNDLE;
 
 constexpr auto CH_INVITE = PACKET_TYPE::CH_INVITE;
 constexpr auto CH_KICK = PACKET_TYPE::CH_KICK;
@@ -107,68 +134,214 @@ constexpr auto NOT_FOUND = PACKET_TYPE::NOT_FOUND;
 constexpr auto HEARTBEAT = PACKET_TYPE::HEARTBEAT;
 constexpr auto ERROR = PACKET_TYPE::ERROR;
 
+// Immutable, reference counted encoded frame. A broadcast is encoded once and
+// the same buffer is handed to every recipient.
+using shared_frame = Frame;
+
 struct Response {
   int id{-1};
   int size{-1};
   PACKET_TYPE type;
-  std::vector<char> data{};
+  shared_frame data{};
 };
 
+inline shared_frame share(Response &&packet) { return std::move(packet.data); }
+
 template <typename T>
 concept HasDataAndSize = requires(T t) {
   { t.data() } -> std::convertible_to<const void *>;
   { t.size() } -> std::convertible_to<std::size_t>;
 };
 
-template <HasDataAndSize T>
-inline Response response(const int32_t id, PACKET_TYPE type, const T &data) {
-  const auto data_size = static_cast<uint32_t>(data.size() + 10);
-  std::vector<char> temporary(data_size + 4);
-  std::memcpy(temporary.data() + 0, &data_size, sizeof(data_size));
-  std::memcpy(temporary.data() + 4, &id, sizeof(id));
-  std::memcpy(temporary.data() + 8, &type, sizeof(type));
-  std::memcpy(temporary.data() + 12, data.data(), data.size());
-  temporary[data_size] = '\x00';
-  temporary[data_size + 1] = '\x00';
+// Object representation of a trivially copyable value, to pass fixed size
+// fields to response().
+template <typename T>
+  requires std::is_trivially_copyable_v<T>
+inline std::string_view raw_bytes(const T &value) {
+  return {reinterpret_cast<const char *>(&value), sizeof(T)};
+}
+
+/* Encodes a frame straight into a pooled buffer:
+ * size (4) | id (4) | type (4) | parts... | 2 NUL bytes
+ */
+template <HasDataAndSize... T>
+inline Response response(const int32_t id, PACKET_TYPE type,
+                         const T &...parts) {
+  const auto data_size = static_cast<uint32_t>((parts.size() + ... + 0) + 10);
+  auto frame = FramePool::acquire(data_size + 4);
+  char *out = frame.get()->data();
+  std::memcpy(out + 0, &data_size, sizeof(data_size));
+  std::memcpy(out + 4, &id, sizeof(id));
+  std::memcpy(out + 8, &type, sizeof(type));
+
+  size_t offset = 12;
+  [[maybe_unused]] auto append = [&](const void *data, size_t size) {
+    if (size > 0)
+      std::memcpy(out + offset, data, size);
+    offset += size;
+  };
+  (append(parts.data(), parts.size()), ...);
+  out[offset] = '\x00';
+  out[offset + 1] = '\x00';
 
   Response packet;
   packet.id = id;
   packet.type = type;
   packet.size = data_size;
-  packet.data = temporary;
+  packet.data = std::move(frame);
   return packet;
 }
 
-inline Response response(const int32_t id, PACKET_TYPE type) {
-  return response(id, type, std::vector<char>());
+// Smallest valid frame body: id + type + the two trailing NUL bytes.
+constexpr uint32_t MIN_FRAME_SIZE = 10;
+constexpr uint32_t MAX_FRAME_SIZE = 64 * 1024;
+
+/* Encodes frames that are already encoded, size prefixes included, back to
+ * back as the payload of one frame.
+ */
+inline Response bundle(const int32_t id, PACKET_TYPE type,
+                       std::span<const shared_frame> frames) {
+  size_t payload_size = 0;
+  for (const auto &frame : frames)
+    payload_size += frame->size();
+
+  const auto data_size = static_cast<uint32_t>(payload_size + 10);
+  auto frame = FramePool::acquire(data_size + 4);
+  char *out = frame.get()->data();
+  std::memcpy(out + 0, &data_size, sizeof(data_size));
+  std::memcpy(out + 4, &id, sizeof(id));
+  std::memcpy(out + 8, &type, sizeof(type));
+
+  size_t offset = 12;
+  for (const auto &inner : frames) {
+    std::memcpy(out + offset, inner->data(), inner->size());
+    offset += inner->size();
+  }
+  out[offset] = '\x00';
+  out[offset + 1] = '\x00';
+
+  Response packet;
+  packet.id = id;
+  packet.type = type;
+  packet.size = data_size;
+  packet.data = std::move(frame);
+  return packet;
 }
 
+/* Splits `frames` into runs that fit one bundle of at most MAX_FRAME_SIZE and
+ * calls `send` with each run, in order. A frame too big to share a bundle
+ * gets a run of its own.
+ */
+template <typename F>
+inline void for_each_bundle(std::span<const shared_frame> frames, F &&send) {
+  while (!frames.empty()) {
+    size_t count = 0;
+    size_t bytes = MIN_FRAME_SIZE;
+    while (count < frames.size() &&
+           (count == 0 || bytes + frames[count]->size() <= MAX_FRAME_SIZE)) {
+      bytes += frames[count++]->size();
+    }
+    send(frames.first(count));
+    frames = frames.subspan(count);
+  }
+}
+
+/* Non-owning view over a frame body (id, type, payload and the two trailing
+ * NUL bytes). The header is decoded in place and `payload` points into the
+ * frame, so the frame has to outlive the request.
+ */
 struct Request {
   int id;
   uint32_t type;
-  std::vector<uint8_t> payload;
+  std::span<const uint8_t> payload;
 
-  Request(std::vector<uint8_t> &data) {
-    this->id = i32_from_le({data[0], data[1], data[2], data[3]});
-    this->type = i32_from_le({data[4], data[5], data[6], data[7]});
-    this->payload = std::vector<uint8_t>(&data[8], &data[data.size() - 2]);
+  Request(std::span<const uint8_t> frame) {
+    this->id = i32_from_le(frame);
+    this->type = i32_from_le(frame.subspan(4));
+    this->payload = frame.subspan(8, frame.size() - 10);
     spdlog::debug("type: {}", this->type);
     spdlog::debug("id: {}", this->id);
   }
 };
 
-inline std::vector<std::vector<uint8_t>> split(const std::vector<uint8_t> &data,
-                                               uint8_t delimiter) {
-  std::vector<std::vector<uint8_t>> result;
-  auto start = data.begin();
+/* Wire formats, picked per connection by SVR_CONNECT.
+ *
+ * v1: size (4) | id (4) | type (4) | payload | 2 NUL bytes
+ * v2: length (varint) | id (zigzag varint) | type (1) | payload
+ *
+ * v2 also packs the message payloads: their ids are varints, and within a
+ * CH_MESSAGE_BUNDLE (the message, channel and sender ids) or a
+ * CH_MESSAGE_BATCH (the channel) they are deltas from the previous entry.
+ * Every other payload is the same in both. The server works
+ * in v1 throughout: a v2 request is decoded to v1 when it is read, and a
+ * reply is encoded to v2 when it is sent.
+ */
+enum class WIRE : uint8_t { V1 = 1, V2 = 2 };
+// Which end sent a frame, the message payloads differ by direction.
+enum class FROM { CLIENT, SERVER };
+
+inline size_t varint_size(uint64_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7)
+    size++;
+  return size;
+}
+
+inline void append_varint(std::string &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7)
+    out.push_back(static_cast<char>(value | 0x80));
+  out.push_back(static_cast<char>(value));
+}
+
+// Reads a varint off the front of `bytes`, false when it is cut short or
+// longer than 10 bytes.
+inline bool read_varint(std::span<const uint8_t> &bytes, uint64_t &value) {
+  value = 0;
+  for (size_t i = 0; i < bytes.size() && i < 10; i++) {
+    value |= static_cast<uint64_t>(bytes[i] & 0x7F) << (7 * i);
+    if ((bytes[i] & 0x80) == 0) {
+      bytes = bytes.subspan(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// `frame`, a whole v1 frame, encoded as v2.
+shared_frame to_v2(const shared_frame &frame, FROM from);
+// A v2 frame body (everything after the length) decoded to a v1 body, false
+// when it is malformed.
+bool decode_v2(std::span<const uint8_t> body, std::vector<uint8_t> &frame,
+               FROM from);
+// Packet type of a whole encoded frame.
+uint32_t frame_type(const shared_frame &frame, WIRE wire);
+
+enum class FRAMESTATUS { READY, PARTIAL, INVALID };
+
+FRAMESTATUS next_frame(RingBuffer &input, std::vector<uint8_t> &frame,
+                       WIRE wire = WIRE::V1);
+
+inline std::vector<std::string_view> split(std::string_view data,
+                                           char delimiter) {
+  std::vector<std::string_view> result;
+  size_t start = 0;
 
-  for (auto it = data.begin(); it != data.end(); ++it) {
-    if (*it == delimiter) {
-      result.emplace_back(start, it);
-      start = it + 1;
+  for (size_t i = 0; i < data.size(); i++) {
+    if (data[i] == delimiter) {
+      result.push_back(data.substr(start, i - start));
+      start = i + 1;
     }
   }
-  result.emplace_back(start, data.end());
+  result.push_back(data.substr(start));
 
   return result;
 }
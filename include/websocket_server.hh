@@ -27,7 +27,6 @@ private:
   std::mutex connections_mtx_;
   std::shared_ptr<Server> tcp_server_;
   std::set<connection_ptr> connections_;
-  std::map<ws_handle, int, std::owner_less<ws_handle>> handle_to_id_;
 
 public:
   void stop();
@@ -38,5 +37,6 @@ public:
 private:
   void on_open(websocketpp::connection_hdl hdl);
   void on_close(websocketpp::connection_hdl hdl);
+  void on_http(websocketpp::connection_hdl hdl);
   void on_message(websocketpp::connection_hdl hdl, message_ptr msg);
 };
@@ -0,0 +1,82 @@
+#include "broadcast_scheduler.hh"
+#include "channel.hh"
+#include "configurations.hh"
+#include <mutex>
+#include <thread>
+
+BroadcastScheduler::BroadcastScheduler(int size) {
+  for (int t = 0; t < size; t++) {
+    this->workers.emplace_back([this]() { this->work(); });
+  }
+}
+
+// Hands a channel back without draining it, its pending messages are
+// dropped with it.
+static void release(Channel *channel) {
+  std::unique_lock lock(channel->queueMutex);
+  channel->scheduled = false;
+  channel->idle.notify_all();
+}
+
+/* Workers stop where they are, the channels still queued are handed back
+ * so that their destructors (which wait for the scheduler to let go) don't
+ * wait forever.
+ */
+BroadcastScheduler::~BroadcastScheduler() {
+  {
+    std::unique_lock lock(this->mtx);
+    this->stop.exchange(true);
+  }
+  this->cv.notify_all();
+
+  for (auto &worker : this->workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+
+  std::deque<Channel *> queued;
+  {
+    std::unique_lock lock(this->mtx);
+    queued.swap(this->ready);
+  }
+  for (Channel *channel : queued)
+    release(channel);
+}
+
+void BroadcastScheduler::schedule(Channel *channel) {
+  bool stopped;
+  {
+    std::unique_lock lock(this->mtx);
+    stopped = this->stop;
+    if (!stopped)
+      this->ready.push_back(channel);
+  }
+  // a worker putting a channel back during shutdown
+  if (stopped)
+    release(channel);
+  else
+    this->cv.notify_one();
+}
+
+void BroadcastScheduler::work() {
+  while (true) {
+    Channel *channel;
+    {
+      std::unique_lock lock(this->mtx);
+      this->cv.wait(lock, [this]() { return stop || !ready.empty(); });
+
+      if (this->stop)
+        return;
+
+      channel = this->ready.front();
+      this->ready.pop_front();
+    }
+
+    // more messages left: back of the line so busy channels can't starve
+    // the quiet ones
+    if (channel->drain(BROADCAST_BATCH)) {
+      this->schedule(channel);
+    }
+  }
+}
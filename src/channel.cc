@@ -1,5 +1,10 @@
 #include "channel.hh"
+#include "broadcast_scheduler.hh"
 #include "client.hh"
+#include "configurations.hh"
+#include "managers.hh"
+#include "message_log.hh"
+#include "metrics.hh"
 #include "spdlog/spdlog.h"
 #include "thread_pool.hh"
 #include "typedef.hh"
@@ -9,64 +14,40 @@
 #include <cstdint>
 #include <cstring>
 #include <format>
+#include <span>
 #include <string>
 #include <sys/types.h>
 #include <vector>
 
-Channel::Channel(uint32_t id, std::string name) : id(id), name(name) {
+Channel::Channel(uint32_t id, std::string name)
+    : id(id), name(name),
+      MAXCAPACITY(ServerConfiguration::instance().channel_members()),
+      history(ServerConfiguration::instance().history_messages()) {
   spdlog::debug("channel created: {0}", this->name);
-  this->messageQueueWorkerThread = std::thread([this]() {
-    while (!this->stopBroadcast) {
-      std::unique_lock lock(this->queueMutex);
-      this->cv.wait(lock, [this]() {
-        return this->stopBroadcast || !this->messageQueue.empty();
-      });
-      if (this->stopBroadcast)
-        return;
-
-      ThreadPool::initialize().enqueue([this]() {
-        std::vector<Response> messages_to_send;
-        {
-          std::unique_lock lock(this->queueMutex);
-          while (!this->messageQueue.empty()) {
-            messages_to_send.push_back(this->messageQueue.front());
-            this->messageQueue.pop();
-          }
-        }
-        for (const auto &packet : messages_to_send) {
-          for (auto member : this->members) {
-            if (auto client = member.lock()) {
-              client->send_packet(packet);
-            }
-          }
-        }
-      });
-    }
-  });
 }
 
 Channel::~Channel() {
   auto data = std::format("{} has been deleted", this->name);
-  auto packet = response(0, CH_DELETE, data);
+  auto frame = share(response(0, CH_DELETE, data));
 
   //
   auto &thread_pool = ThreadPool::initialize();
-  for (w_client w_client : this->members) {
+  for (const w_client &w_client : this->members.handles()) {
     if (!w_client.expired()) {
       auto s_client = w_client.lock();
       s_client->remove_channel(this->id);
       if (s_client->connected) {
         thread_pool.enqueue(
-            [packet, s_client]() { s_client->send_packet(packet); });
+            [frame, s_client]() { s_client->send_packet(frame); });
       }
     }
   }
 
-  this->stopBroadcast.exchange(true);
-  this->cv.notify_all();
-
-  if (this->messageQueueWorkerThread.joinable()) {
-    this->messageQueueWorkerThread.join();
+  // the scheduler may still hold this channel, wait until it lets go
+  {
+    std::unique_lock lock(this->queueMutex);
+    this->messageQueue = {};
+    this->idle.wait(lock, [this]() { return !this->scheduled; });
   }
 
   spdlog::debug("channel destroyed: {0}", this->name);
@@ -78,13 +59,20 @@ Channel::~Channel() {
  *
  * If the channel is secret, check if the client was invited.
  */
-JOINRESULT Channel::join_channel(const w_client &w_client) {
-  auto s_client = w_client.lock();
-  auto is_banned = std::find_if(this->banned.begin(), this->banned.end(),
-                                [&](int id) { return id == s_client->id; });
-  if (is_banned != this->banned.end())
+JOINRESULT Channel::join_channel(const w_client &w_client,
+                                 const Replay *replay) {
+  uint32_t client_id = w_client.lock()->id;
+  std::unique_lock lock(this->mtx);
+  if (this->banned.contains(client_id))
     return JOINRESULT::BANNED;
 
+  // joining twice only gets the reply, and doesn't use up an invitation
+  if (this->members.contains(client_id)) {
+    if (replay != nullptr)
+      this->send_join(w_client, Replay{.request_id = replay->request_id});
+    return JOINRESULT::SUCCESS;
+  }
+
   // capacity check before secrecy so invitation doesn't get deleted on full
   // server
   if (this->members.size() >= this->MAXCAPACITY) {
@@ -92,17 +80,41 @@ JOINRESULT Channel::join_channel(const w_client &w_client) {
   }
 
   // if no invitation was deleted that means the client wasn't invited
-  if (this->secret && std::erase_if(this->invitations, [&](int id) {
-                        return id == s_client->id;
-                      }) == 0) {
+  if (this->secret && this->invitations.erase(client_id) == 0) {
     return JOINRESULT::SECRET;
   }
 
-  this->members.push_back(w_client);
+  this->members.add(client_id, w_client);
+  // taken together with what a drain records, so every message reaches the
+  // new member once, live or replayed. The reply and the replay are queued
+  // before the member is published, so no live message overtakes them.
+  std::unique_lock history_lock(this->history_mtx);
+  if (replay != nullptr)
+    this->send_join(w_client, *replay);
+  this->publish_members();
 
   return JOINRESULT::SUCCESS;
 }
 
+/* Queues the CH_JOIN reply, then the missed messages in CH_MESSAGE_BUNDLE
+ * frames with the request's id (a lone message as it is). `mtx` and
+ * `history_mtx` must be held.
+ */
+void Channel::send_join(const w_client &w_client, const Replay &replay) {
+  auto s_client = w_client.lock();
+  s_client->send_packet(::response(replay.request_id, CH_JOIN, this->info()));
+  if (replay.count == 0)
+    return;
+
+  auto frames = this->history.last(replay.count, replay.after);
+  for_each_bundle(frames, [&](std::span<const shared_frame> run) {
+    if (run.size() == 1)
+      s_client->send_packet(run[0]);
+    else
+      s_client->send_packet(bundle(replay.request_id, CH_MESSAGE_BUNDLE, run));
+  });
+}
+
 /* Disconnects a member from the channel.
  * The returned bool answers if the channel should be flagged for deletion or
  * not. It will only be true if no moderators are available when the emperor
@@ -111,15 +123,15 @@ JOINRESULT Channel::join_channel(const w_client &w_client) {
 void Channel::leave_channel(const w_client &w_client) {
   auto s_client = w_client.lock();
   std::unique_lock lock(this->mtx);
-  // try to remove member from member pool
-  std::erase_if(this->members, [&](const ::w_client &member) {
-    return member.lock() == s_client;
-  });
+  // moderator status goes with the membership
+  if (this->members.remove(s_client->id))
+    this->publish_members();
+}
 
-  // try to remove member from the moderator pool
-  std::erase_if(this->moderators, [&](const ::w_client &w_client) {
-    return w_client.lock() == s_client;
-  });
+/* Swaps in a snapshot of the current members, `mtx` must be held.
+ */
+void Channel::publish_members() {
+  this->recipients.store(this->members.snapshot(), std::memory_order_release);
 }
 
 std::vector<char> Channel::info() {
@@ -127,8 +139,7 @@ std::vector<char> Channel::info() {
   auto name = this->name;
   auto secret = this->secret ? 1 : 0;
 
-  std::vector<char> information;
-  information.reserve(5 + name.size());
+  std::vector<char> information(5 + name.size());
 
   std::memcpy(information.data(), &id, sizeof(id));
   std::memcpy(information.data() + 4, &secret, 1);
@@ -137,25 +148,112 @@ std::vector<char> Channel::info() {
   return information;
 }
 
+/* Encodes the message once, every member is sent the same shared frame.
+ */
 void Channel::queue_message(const MessageView view) {
-  auto channel_id = view.channel_id;
-  auto client_id = view.sender_id;
-  auto reply_to = view.reply_to;
-  auto message = view.message;
+  auto frame = share(response(0, CH_MESSAGE, raw_bytes(view.channel_id),
+                              raw_bytes(view.sender_id),
+                              raw_bytes(view.reply_to), view.message));
+
+  bool schedule;
+  {
+    std::unique_lock lock(this->queueMutex);
+    // numbered in queue order, the history relies on it
+    int32_t seq = this->packetIds.fetch_add(1);
+    std::memcpy(frame.get()->data() + 4, &seq, sizeof(seq));
+    this->messageQueue.push({std::move(frame), Metrics::now()});
+    schedule = !this->scheduled;
+    this->scheduled = true;
+  }
+
+  if (schedule) {
+    BroadcastScheduler::instance().schedule(this);
+  }
+}
 
-  std::vector<char> payload;
-  payload.resize(12 + message.size());
+/* Sends up to `batch` pending messages to every member, in queue order.
+ * Only ever runs on one broadcast worker at a time for a given channel.
+ *
+ * When several messages are pending they go out bundled in CH_MESSAGE_BUNDLE
+ * frames (up to MAX_FRAME_SIZE each), one send per member per bundle
+ * instead of one per message.
+ *
+ * Returns true if messages are still pending and the channel has to be
+ * scheduled again, otherwise the channel is handed back (`scheduled` false).
+ */
+bool Channel::drain(size_t batch) {
+  std::vector<shared_frame> messages_to_send;
+  int64_t dequeued = Metrics::now();
+  {
+    std::unique_lock lock(this->queueMutex);
+    while (!this->messageQueue.empty() && messages_to_send.size() < batch) {
+      auto &message = this->messageQueue.front();
+      Metrics::record(STAGE::QUEUE, message.queued_at, dequeued);
+      messages_to_send.push_back(std::move(message.frame));
+      this->messageQueue.pop();
+    }
+  }
 
-  std::memcpy(payload.data(), &channel_id, sizeof(channel_id));
-  std::memcpy(payload.data() + 4, &client_id, sizeof(client_id));
-  std::memcpy(payload.data() + 8, &reply_to, sizeof(reply_to));
-  std::memcpy(payload.data() + 12, &message, message.size());
+  // a join or leave during the batch shows up from the next one on
+  std::shared_ptr<const Membership::Snapshot> recipients;
+  {
+    std::unique_lock lock(this->history_mtx);
+    recipients = this->recipients.load(std::memory_order_acquire);
+    for (const auto &frame : messages_to_send)
+      this->history.record(frame);
+    // in id order, like the history
+    if (auto *log = MessageLog::instance()) {
+      for (const auto &frame : messages_to_send)
+        log->append(this->id, frame);
+    }
+  }
+  // v2 members share one encoding of the frame too, made for the first
+  auto send_all = [&](const shared_frame &frame) {
+    shared_frame compact;
+    for (const auto &member : *recipients) {
+      if (auto client = member.lock()) {
+        auto wire = client->wire.load(std::memory_order_acquire);
+        if (wire == WIRE::V1) {
+          client->send_encoded(frame, wire);
+          continue;
+        }
+        if (!compact)
+          compact = to_v2(frame, FROM::SERVER);
+        client->send_encoded(compact, wire);
+      }
+    }
+  };
+
+  for_each_bundle(messages_to_send, [&](std::span<const shared_frame> run) {
+    if (run.size() == 1) {
+      send_all(run[0]);
+    } else {
+      // carries the id of its last message, packetIds only numbers messages
+      int32_t last;
+      std::memcpy(&last, run.back()->data() + 4, sizeof(last));
+      send_all(share(bundle(last, CH_MESSAGE_BUNDLE, run)));
+    }
+    for (size_t i = 0; i < run.size(); i++)
+      Metrics::record(STAGE::SEND, dequeued);
+  });
 
-  Response packet = response(this->packetIds, CH_MESSAGE, payload);
   std::unique_lock lock(this->queueMutex);
-  this->messageQueue.push(packet);
-  this->packetIds.fetch_add(1);
-  this->cv.notify_one();
+  if (!this->messageQueue.empty())
+    return true;
+
+  this->scheduled = false;
+  this->idle.notify_all();
+  return false;
+}
+
+size_t Channel::history_bytes() {
+  std::unique_lock lock(this->history_mtx);
+  return this->history.bytes();
+}
+
+size_t Channel::queue_depth() {
+  std::unique_lock lock(this->queueMutex);
+  return this->messageQueue.size();
 }
 
 // UTILITIES
@@ -163,10 +261,10 @@ void Channel::queue_message(const MessageView view) {
 // Checks if the actor is a moderator or emperor
 bool Channel::is_moderator(const w_client &w_client) {
   auto target = w_client.lock();
-  auto it =
-      std::find_if(this->moderators.begin(), this->moderators.end(),
-                   [&](const ::w_client mo) { return mo.lock() == target; });
-  return it != this->moderators.end() || target->admin;
+  if (target->admin)
+    return true;
+  std::unique_lock lock(this->mtx);
+  return this->members.is_moderator(target->id);
 }
 
 // CH_COMMAND HANDLERS
@@ -176,7 +274,12 @@ bool Channel::is_moderator(const w_client &w_client) {
 MODERATIONRESULT Channel::change_privacy(const w_client &w_client) {
   spdlog::debug("{} privacy has changed", this->name);
   if (w_client.lock()->admin) {
-    this->secret.exchange(!this->secret);
+    // toggled and published together, so the CH_LIST directory ends up
+    // with the last toggle's value
+    std::unique_lock lock(this->mtx);
+    bool secret = !this->secret.load();
+    this->secret.store(secret);
+    ChannelManager::instance().directory().set_secret(this->id, secret);
     return MODERATIONRESULT::SUCCESS;
   }
   return MODERATIONRESULT::UNAUTHORIZED;
@@ -186,19 +289,21 @@ MODERATIONRESULT Channel::change_privacy(const w_client &w_client) {
  * - Only moderators can execute this command.
  */
 MODERATIONRESULT Channel::kick_member(const w_client &wclient, int target_id) {
-  auto target = std::find_if(
-      this->members.begin(), this->members.end(),
-      [&](const ::w_client member) { return member.lock()->id == target_id; });
-
-  if (target == this->members.end())
+  std::shared_ptr<Client> s_target;
+  {
+    std::unique_lock lock(this->mtx);
+    if (auto target = this->members.find(target_id))
+      s_target = target->lock();
+  }
+  if (s_target == nullptr)
     return MODERATIONRESULT::NOT_FOUND;
 
-  if ((this->is_moderator(*target) && !wclient.lock()->admin) ||
+  if ((this->is_moderator(s_target) && !wclient.lock()->admin) ||
       !this->is_moderator(wclient))
     return MODERATIONRESULT::UNAUTHORIZED;
 
-  spdlog::debug("{} was kicked from: {}", target->lock()->username, this->name);
-  this->leave_channel(*target);
+  spdlog::debug("{} was kicked from: {}", s_target->username, this->name);
+  this->leave_channel(s_target);
   return MODERATIONRESULT::SUCCESS;
 }
 
@@ -211,22 +316,18 @@ MODERATIONRESULT Channel::promote_member(const w_client &w_client,
   if (!s_client->admin)
     return MODERATIONRESULT::UNAUTHORIZED;
 
-  auto target_member = std::find_if(
-      this->members.begin(), this->members.end(),
-      [&](const ::w_client member) { return member.lock()->id == target_id; });
-
-  if (target_member == this->members.end())
+  std::unique_lock lock(this->mtx);
+  if (!this->members.set_moderator(target_id, true))
     return MODERATIONRESULT::NOT_FOUND;
 
-  this->moderators.push_back(*target_member);
   spdlog::debug("member promoted to moderator: {0} -> {1}", this->name,
-                target_member->lock()->username);
+                target_id);
   return MODERATIONRESULT::SUCCESS;
 }
 
 ChannelView::ChannelView(Channel *channel) {
-  this->id = &channel->id;
-  this->name = &channel->name;
+  this->id = channel->id;
+  this->name = channel->name;
   this->secret = channel->secret;
 }
 
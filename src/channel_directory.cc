@@ -0,0 +1,127 @@
+#include "channel_directory.hh"
+#include <algorithm>
+#include <string>
+
+void ChannelDirectory::upsert(uint32_t id, bool secret,
+                              std::string_view name) {
+  std::unique_lock lock(this->mtx_);
+  auto at = std::lower_bound(
+      this->entries_.begin(), this->entries_.end(), id,
+      [](const Entry &entry, uint32_t id) { return entry.id < id; });
+  size_t position = at - this->entries_.begin();
+  if (at != this->entries_.end() && at->id == id) {
+    if (at->secret == secret && at->name == name)
+      return;
+    *at = {id, secret, std::string(name)};
+  } else {
+    this->entries_.insert(at, {id, secret, std::string(name)});
+  }
+  this->cut_from(position);
+  this->version_.fetch_add(1, std::memory_order_release);
+}
+
+void ChannelDirectory::erase(uint32_t id) {
+  std::unique_lock lock(this->mtx_);
+  auto at = std::lower_bound(
+      this->entries_.begin(), this->entries_.end(), id,
+      [](const Entry &entry, uint32_t id) { return entry.id < id; });
+  if (at == this->entries_.end() || at->id != id)
+    return;
+  size_t position = at - this->entries_.begin();
+  this->entries_.erase(at);
+  this->cut_from(position);
+  this->version_.fetch_add(1, std::memory_order_release);
+}
+
+void ChannelDirectory::set_secret(uint32_t id, bool secret) {
+  std::unique_lock lock(this->mtx_);
+  auto at = std::lower_bound(
+      this->entries_.begin(), this->entries_.end(), id,
+      [](const Entry &entry, uint32_t id) { return entry.id < id; });
+  if (at == this->entries_.end() || at->id != id || at->secret == secret)
+    return;
+  at->secret = secret;
+  // same size, the page boundaries hold
+  if (!this->pages_.empty())
+    this->pages_[this->page_of(at - this->entries_.begin())].frame = {};
+  this->version_.fetch_add(1, std::memory_order_release);
+}
+
+ChannelDirectory::Page ChannelDirectory::page(size_t index) {
+  std::unique_lock lock(this->mtx_);
+  this->encode();
+  if (index >= this->pages_.size())
+    return {this->version(), std::nullopt};
+  const auto &page = this->pages_[index];
+  return {page.version, page.frame};
+}
+
+size_t ChannelDirectory::page_of(size_t at) const {
+  auto after = std::upper_bound(
+      this->pages_.begin(), this->pages_.end(), at,
+      [](size_t at, const Encoded &page) { return at < page.start; });
+  return after == this->pages_.begin() ? 0 : after - this->pages_.begin() - 1;
+}
+
+void ChannelDirectory::cut_from(size_t at) {
+  if (this->pages_.empty())
+    return;
+  this->pages_.resize(this->page_of(at));
+  // its entries are unchanged, but it became the last page when nothing is
+  // left to page after it
+  if (!this->pages_.empty()) {
+    auto &back = this->pages_.back();
+    if (back.start + back.count == this->entries_.size())
+      back.frame = {};
+  }
+}
+
+void ChannelDirectory::encode() {
+  size_t next = this->pages_.empty()
+                    ? 0
+                    : this->pages_.back().start + this->pages_.back().count;
+  // an empty directory is one empty page
+  while (next < this->entries_.size() || this->pages_.empty()) {
+    size_t bytes = 0;
+    size_t count = 0;
+    while (next + count < this->entries_.size()) {
+      size_t size = this->entries_[next + count].encoded_size();
+      if (count > 0 && bytes + size > PAGE_BYTES)
+        break;
+      bytes += size;
+      count++;
+    }
+    this->pages_.push_back({next, count, 0});
+    next += count;
+  }
+
+  for (size_t i = 0; i < this->pages_.size(); i++) {
+    if (!this->pages_[i].frame)
+      this->encode_page(i);
+  }
+}
+
+/* version (4) | page (4) | last page (1) | entries...
+ * entry: id (4) | secret (1) | name length (2) | name
+ */
+void ChannelDirectory::encode_page(size_t index) {
+  auto &page = this->pages_[index];
+  page.version = this->version();
+
+  std::string payload;
+  payload.reserve(PAGE_HEADER + PAGE_BYTES);
+  auto page_index = static_cast<uint32_t>(index);
+  payload.append(raw_bytes(page.version));
+  payload.append(raw_bytes(page_index));
+  payload.push_back(index + 1 == this->pages_.size() ? 1 : 0);
+  for (size_t i = page.start; i < page.start + page.count; i++) {
+    const auto &entry = this->entries_[i];
+    auto name = std::string_view(entry.name).substr(0, UINT16_MAX);
+    auto name_size = static_cast<uint16_t>(name.size());
+    payload.append(raw_bytes(entry.id));
+    payload.push_back(entry.secret ? 1 : 0);
+    payload.append(raw_bytes(name_size));
+    payload.append(name);
+  }
+  page.frame = share(response(0, CH_LIST, payload));
+}
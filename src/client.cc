@@ -1,37 +1,143 @@
 #include "client.hh"
 #include "configurations.hh"
+#include "metrics.hh"
+#include "uring_reactor.hh"
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <cstddef>
 #include <format>
 #include <mutex>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <utility>
 #include <vector>
 
-void Client::add_channel(const int channelId) {
+void Client::add_channel(uint32_t channelId) {
   std::unique_lock lock(this->mtx);
-  this->channels.push_back(channelId);
+  this->channels.insert(channelId);
 }
 
-void Client::remove_channel(const int channelId) {
+void Client::remove_channel(uint32_t channelId) {
   std::unique_lock lock(this->mtx);
-  std::erase_if(this->channels,
-                [&](const int &channel) { return channel == channelId; });
+  this->channels.erase(channelId);
 }
 
-bool Client::send_packet(const Response packet) {
-  auto data = packet.data;
-  if (send(this->fd, data.data(), data.size(), 0) == -1) {
+bool Client::send_packet(Response packet) {
+  return this->send_packet(share(std::move(packet)));
+}
+
+/* Sends a v1 frame, encoded as v2 when the client negotiated it.
+ */
+bool Client::send_packet(const shared_frame &frame) {
+  auto wire = this->wire.load(std::memory_order_acquire);
+  if (wire == WIRE::V2)
+    return this->send_encoded(to_v2(frame, FROM::SERVER), wire);
+  return this->send_encoded(frame, wire);
+}
+
+/* Queues the frame on the client's bounded outbound queue.
+ *
+ * WebSocket clients hand the frame to their endpoint instead, which keeps
+ * its own per-connection write queue.
+ *
+ * When the socket is writable the queue is flushed right away, otherwise the
+ * frame waits for the reactor to see EPOLLOUT. A client whose queue is full
+ * is too slow to keep up, its socket is shut down and the reactor drops it.
+ */
+bool Client::send_encoded(const shared_frame &frame, WIRE wire) {
+  uint32_t type = frame_type(frame, wire);
+
+  if (this->transport == ClientTransport::WBS) {
+    websocketpp::lib::error_code ec;
+    this->ws_endpoint->send(this->ws_hld.value(), frame->data(), frame->size(),
+                            websocketpp::frame::opcode::binary, ec);
+    if (ec) {
+      Metrics::count(COUNTER::SEND_FAILURES);
+      return false;
+    }
+    Metrics::packet_out(type, frame->size());
+    return true;
+  }
+
+  std::unique_lock lock(this->out_mtx);
+  if (this->outbound.size() >= MAX_OUTBOUND_FRAMES) {
+    spdlog::warn("{} is a slow consumer, dropping connection", this->username);
+    shutdown(this->fd, SHUT_RDWR);
+    Metrics::count(COUNTER::SEND_FAILURES);
     return false;
   }
+  Metrics::packet_out(type, frame->size());
+
+  this->outbound.push_back(frame);
+  this->out_depth.store(this->outbound.size());
+  if (this->uring != nullptr) {
+    if (!std::exchange(this->flush_pending, true))
+      this->uring->request_flush(this->fd);
+    return true;
+  }
+
+  if (!this->writable)
+    return true;
+  return this->flush_locked();
+}
+
+/* Called by the reactor once the socket reports EPOLLOUT.
+ */
+bool Client::flush() {
+  std::unique_lock lock(this->out_mtx);
+  this->writable = true;
+  return this->flush_locked();
+}
+
+/* Writes as much of the queue as the socket takes, coalescing up to
+ * FLUSH_BATCH frames into each sendmsg (a writev that can't raise SIGPIPE).
+ */
+bool Client::flush_locked() {
+  constexpr size_t FLUSH_BATCH = 64;
+  iovec iov[FLUSH_BATCH];
+
+  while (!this->outbound.empty()) {
+    size_t count = 0;
+    for (auto it = this->outbound.begin();
+         it != this->outbound.end() && count < FLUSH_BATCH; ++it, ++count) {
+      size_t skip = count == 0 ? this->out_offset : 0;
+      iov[count].iov_base = const_cast<char *>((*it)->data()) + skip;
+      iov[count].iov_len = (*it)->size() - skip;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t n = sendmsg(this->fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        this->writable = false;
+        return true;
+      }
+      Metrics::count(COUNTER::SEND_FAILURES);
+      return false;
+    }
+
+    size_t written = n + this->out_offset;
+    while (!this->outbound.empty() &&
+           written >= this->outbound.front()->size()) {
+      written -= this->outbound.front()->size();
+      this->outbound.pop_front();
+    }
+    this->out_offset = written;
+    this->out_depth.store(this->outbound.size());
+  }
   return true;
 }
 
-bool Client::is_member(const int channelId) {
-  return std::find_if(this->channels.begin(), this->channels.end(),
-                      [&](const int id) { return id == channelId; }) !=
-         this->channels.end();
+bool Client::is_member(uint32_t channelId) const {
+  return this->channels.contains(channelId);
 }
 
 void Client::set_connection(bool b) {
@@ -39,15 +145,13 @@ void Client::set_connection(bool b) {
   spdlog::debug("{} connection status changed: {}", this->username, b);
 }
 
-std::string Client::change_username(const std::vector<uint8_t> bytes) {
+std::string Client::change_username(std::string_view username) {
   std::unique_lock lock(this->mtx);
-  std::string username(bytes.begin(), bytes.end());
   this->username = std::format("{0}{1}", username, this->id);
   return this->username;
 }
 
-void Client::set_admin(const std::vector<uint8_t> bytes) {
-  std::string password(bytes.begin(), bytes.end());
+void Client::set_admin(std::string_view password) {
   if (password == ServerConfiguration::instance().secret()) {
     spdlog::debug("{} registered as an admin", this->username);
     std::unique_lock lock(this->mtx);
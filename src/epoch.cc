@@ -0,0 +1,144 @@
+#include "epoch.hh"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Every slot ever handed out, slots of exited threads get reused.
+std::atomic<EpochSlot *> slots{nullptr};
+
+struct Retired {
+  uint64_t epoch;
+  std::function<void()> deleter;
+};
+
+/* Retired versions wait here for the reclaimer thread, which frees them once
+ * no slot is pinned at or before their epoch. Readers unpin without telling
+ * anyone, so while something is left waiting the reclaimer looks again every
+ * RECHECK. Deleters never run on the thread that retired, so removing a
+ * channel doesn't run its destructor on that strand. It can still run on
+ * one: a strand task holding the last ChannelHandle from a lookup drops it
+ * there, and ~Channel then blocks it until a broadcast worker lets go of
+ * the channel.
+ */
+struct Retirement {
+  static constexpr auto RECHECK = std::chrono::milliseconds(1);
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::vector<Retired> pending{};
+  bool stop{false};
+  std::thread reclaimer;
+
+  Retirement() : reclaimer([this]() { this->reclaim(); }) {}
+
+  // nothing reads anymore at exit
+  ~Retirement() {
+    {
+      std::unique_lock lock(this->mtx);
+      this->stop = true;
+    }
+    this->cv.notify_one();
+    this->reclaimer.join();
+    for (auto &retired : this->pending)
+      retired.deleter();
+  }
+
+  // Moves what no reader can see anymore to `ready`, `mtx` held.
+  void take_ready(std::vector<Retired> &ready) {
+    uint64_t oldest = EpochSlot::IDLE;
+    for (auto *slot = slots.load(std::memory_order_acquire); slot != nullptr;
+         slot = slot->next) {
+      oldest = std::min(oldest, slot->epoch.load(std::memory_order_seq_cst));
+    }
+
+    auto safe = std::partition(
+        this->pending.begin(), this->pending.end(),
+        [oldest](const Retired &retired) { return retired.epoch >= oldest; });
+    std::move(safe, this->pending.end(), std::back_inserter(ready));
+    this->pending.erase(safe, this->pending.end());
+  }
+
+  void reclaim() {
+    std::vector<Retired> ready;
+    std::unique_lock lock(this->mtx);
+    while (true) {
+      this->cv.wait(lock,
+                    [this]() { return this->stop || !this->pending.empty(); });
+      if (this->stop)
+        return;
+
+      this->take_ready(ready);
+      if (ready.empty()) {
+        this->cv.wait_for(lock, RECHECK, [this]() { return this->stop; });
+        continue;
+      }
+
+      // outside the lock, a deleter may free things that retire in turn
+      lock.unlock();
+      for (auto &retired : ready)
+        retired.deleter();
+      ready.clear();
+      lock.lock();
+    }
+  }
+
+  static Retirement &instance() {
+    static Retirement retirement;
+    return retirement;
+  }
+};
+
+// Hands the thread's slot back when the thread exits.
+struct SlotRelease {
+  EpochSlot *slot{nullptr};
+
+  ~SlotRelease() {
+    if (this->slot != nullptr)
+      this->slot->in_use.store(false, std::memory_order_release);
+  }
+};
+
+thread_local SlotRelease slot_release;
+
+} // namespace
+
+EpochSlot *Epoch::acquire_slot() {
+  for (auto *slot = slots.load(std::memory_order_acquire); slot != nullptr;
+       slot = slot->next) {
+    bool in_use = false;
+    if (slot->in_use.compare_exchange_strong(in_use, true)) {
+      slot_release.slot = slot;
+      return slot;
+    }
+  }
+
+  auto *slot = new EpochSlot();
+  slot->next = slots.load(std::memory_order_relaxed);
+  while (!slots.compare_exchange_weak(slot->next, slot,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed))
+    ;
+  slot_release.slot = slot;
+  return slot;
+}
+
+void Epoch::retire(std::function<void()> deleter) {
+  auto &retirement = Retirement::instance();
+  {
+    std::unique_lock lock(retirement.mtx);
+    // readers pinned from here on see the new version
+    uint64_t epoch = global_.fetch_add(1, std::memory_order_seq_cst);
+    retirement.pending.push_back({epoch, std::move(deleter)});
+  }
+  retirement.cv.notify_one();
+}
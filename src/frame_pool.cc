@@ -0,0 +1,167 @@
+#include "frame_pool.hh"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace {
+
+constexpr uint8_t OVERSIZED = FramePool::CLASSES;
+// Buffers a thread keeps per class before handing a batch to the depot.
+constexpr size_t CACHE_LIMITS[FramePool::CLASSES] = {256, 256, 128,
+                                                     64,  16,  8};
+// Buffers the depot keeps per class, anything above goes back to the heap.
+constexpr size_t DEPOT_LIMITS[FramePool::CLASSES] = {4096, 4096, 2048,
+                                                     1024, 256,  64};
+
+std::atomic_uint64_t allocations{0};
+std::atomic_uint64_t frees{0};
+std::atomic_uint64_t oversized{0};
+
+struct FreeList {
+  FrameBuffer *head{nullptr};
+  size_t count{0};
+
+  inline void push(FrameBuffer *buffer) {
+    buffer->next = this->head;
+    this->head = buffer;
+    this->count++;
+  }
+
+  inline FrameBuffer *pop() {
+    FrameBuffer *buffer = this->head;
+    this->head = buffer->next;
+    this->count--;
+    return buffer;
+  }
+
+  // Moves up to `n` buffers from the front of this list onto `other`.
+  inline void move_to(FreeList &other, size_t n) {
+    while (n-- > 0 && this->head != nullptr) {
+      other.push(this->pop());
+    }
+  }
+};
+
+FrameBuffer *allocate(uint8_t size_class, size_t capacity) {
+  void *memory = ::operator new(sizeof(FrameBuffer) + capacity);
+  auto *buffer = new (memory) FrameBuffer();
+  buffer->capacity = capacity;
+  buffer->size_class = size_class;
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return buffer;
+}
+
+void destroy(FrameBuffer *buffer) {
+  buffer->~FrameBuffer();
+  ::operator delete(buffer);
+  frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Shared between threads, only touched a batch at a time. Never destroyed so
+// threads that exit during static destruction can still return buffers.
+struct Depot {
+  std::mutex mtx;
+  FreeList lists[FramePool::CLASSES];
+
+  static Depot &instance() {
+    static Depot *depot = new Depot();
+    return *depot;
+  }
+};
+
+// Set once the thread's cache is gone, frames released afterwards (static
+// destructors) go straight back to the heap.
+thread_local bool cache_destroyed = false;
+
+struct ThreadCache {
+  FreeList lists[FramePool::CLASSES];
+
+  ~ThreadCache() {
+    cache_destroyed = true;
+    for (auto &list : this->lists) {
+      while (list.head != nullptr)
+        destroy(list.pop());
+    }
+  }
+};
+
+thread_local ThreadCache cache;
+
+inline uint8_t class_of(size_t size) {
+  for (uint8_t c = 0; c < FramePool::CLASSES; c++) {
+    if (size <= FramePool::CLASS_SIZES[c])
+      return c;
+  }
+  return OVERSIZED;
+}
+
+} // namespace
+
+void Frame::reset() {
+  if (this->buffer_ != nullptr &&
+      this->buffer_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    FramePool::release(this->buffer_);
+  }
+  this->buffer_ = nullptr;
+}
+
+Frame FramePool::acquire(size_t size) {
+  uint8_t size_class = class_of(size);
+  FrameBuffer *buffer = nullptr;
+
+  if (size_class == OVERSIZED) {
+    oversized.fetch_add(1, std::memory_order_relaxed);
+    buffer = allocate(OVERSIZED, size);
+  } else if (cache_destroyed) {
+    buffer = allocate(size_class, CLASS_SIZES[size_class]);
+  } else {
+    auto &local = cache.lists[size_class];
+    if (local.head == nullptr) {
+      auto &depot = Depot::instance();
+      std::unique_lock lock(depot.mtx);
+      depot.lists[size_class].move_to(local, CACHE_LIMITS[size_class] / 2);
+    }
+
+    if (local.head != nullptr) {
+      buffer = local.pop();
+      buffer->refs.store(1, std::memory_order_relaxed);
+    } else {
+      buffer = allocate(size_class, CLASS_SIZES[size_class]);
+    }
+  }
+
+  buffer->length = size;
+  return Frame(buffer);
+}
+
+void FramePool::release(FrameBuffer *buffer) {
+  uint8_t size_class = buffer->size_class;
+  if (size_class == OVERSIZED || cache_destroyed) {
+    destroy(buffer);
+    return;
+  }
+
+  auto &local = cache.lists[size_class];
+  local.push(buffer);
+  if (local.count <= CACHE_LIMITS[size_class])
+    return;
+
+  FreeList spill;
+  local.move_to(spill, CACHE_LIMITS[size_class] / 2);
+  {
+    auto &depot = Depot::instance();
+    std::unique_lock lock(depot.mtx);
+    auto &shared = depot.lists[size_class];
+    spill.move_to(shared, DEPOT_LIMITS[size_class] - shared.count);
+  }
+  while (spill.head != nullptr)
+    destroy(spill.pop());
+}
+
+FramePool::Stats FramePool::stats() {
+  return {allocations.load(std::memory_order_relaxed),
+          frees.load(std::memory_order_relaxed),
+          oversized.load(std::memory_order_relaxed)};
+}
@@ -58,7 +58,16 @@ void setup_logger(bool debug_mode) {
  * --channels=0
  * --clients=0
  * --threads=0
+ * --reactors=0
+ * --broadcasters=0
+ * --members=50 (per channel)
+ * --history=64 (messages kept per channel for replay on join, 0 for none)
+ * --history-bytes=67108864 (what every channel's history holds together)
+ * --data-dir=path (keeps a durable log of every broadcast and snapshots of
+ *   the channels, restored on startup; off by default)
+ * --snapshot-interval=30 (seconds between channel snapshots, 0 for none)
  * --port=0000
+ * --io=epoll|uring
  */
 int main(int argc, char *argv[]) {
   // global configuration class;
@@ -82,6 +91,38 @@ int main(int argc, char *argv[]) {
           auto substr = arg.substr(10);
           configuration.set_pool_size(std::stoi(substr));
           continue;
+        } else if (arg.rfind("--reactors=", 0) == 0) {
+          auto substr = arg.substr(11);
+          configuration.set_reactors(std::stoi(substr));
+          continue;
+        } else if (arg.rfind("--broadcasters=", 0) == 0) {
+          auto substr = arg.substr(15);
+          configuration.set_broadcast_workers(std::stoi(substr));
+          continue;
+        } else if (arg.rfind("--members=", 0) == 0) {
+          auto substr = arg.substr(10);
+          configuration.set_channel_members(std::stoi(substr));
+          continue;
+        } else if (arg.rfind("--history=", 0) == 0) {
+          auto substr = arg.substr(10);
+          configuration.set_history(std::stoi(substr));
+          continue;
+        } else if (arg.rfind("--history-bytes=", 0) == 0) {
+          auto substr = arg.substr(16);
+          configuration.set_history_bytes(std::stoull(substr));
+          continue;
+        } else if (arg.rfind("--data-dir=", 0) == 0) {
+          configuration.set_data_dir(arg.substr(11));
+          continue;
+        } else if (arg.rfind("--snapshot-interval=", 0) == 0) {
+          auto substr = arg.substr(20);
+          configuration.set_snapshot_interval(std::stoi(substr));
+          continue;
+        } else if (arg.rfind("--io=", 0) == 0) {
+          auto backend = arg.substr(5);
+          configuration.set_io_backend(backend == "uring" ? IOBACKEND::URING
+                                                          : IOBACKEND::EPOLL);
+          continue;
         } else if (arg.rfind("--port=", 0) == 0) {
           auto substr = arg.substr(7);
           configuration.set_port(std::stoi(substr));
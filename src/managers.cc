@@ -7,94 +7,292 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <sys/types.h>
 #include <utility>
 #include <vector>
 
 bool ChannelManager::has_capacity() {
-  return this->MAXCHANNELS > this->channels.size();
+  return this->MAXCHANNELS > this->count_.load();
+}
+
+ChannelManager::~ChannelManager() {
+  for (auto &shard : this->shards_) {
+    delete shard.table.load();
+  }
+}
+
+const ChannelManager::Table *
+ChannelManager::replace_table(Shard &shard, const Table *updated) {
+  const Table *replaced = shard.table.load(std::memory_order_relaxed);
+  shard.table.store(updated, std::memory_order_seq_cst);
+  return replaced;
+}
+
+void ChannelManager::retire_table(const Table *table) {
+  Epoch::retire([table] { delete table; });
 }
 
 void ChannelManager::remove_channel(uint32_t i) {
-  std::unique_lock lock(this->mutex);
-  this->channels.erase(i);
+  auto &shard = this->shard_of(i);
+  const Table *replaced;
+  {
+    std::unique_lock lock(shard.write_mtx);
+    const Table *table = shard.table.load(std::memory_order_relaxed);
+    if (!table->contains(i))
+      return;
+
+    auto *updated = new Table(*table);
+    updated->erase(i);
+    this->count_.fetch_sub(1);
+    replaced = replace_table(shard, updated);
+    this->directory_.erase(i);
+  }
+  // the replaced map holds the table's last handle, the channel goes once
+  // lookups that may still see it are done
+  retire_table(replaced);
 }
 
-Channel *ChannelManager::find_channel(uint32_t i) const {
-  auto find = this->channels.find(i);
-  if (find == this->channels.end()) {
+ChannelHandle ChannelManager::find_channel(uint32_t i) const {
+  Epoch::Guard guard;
+  const Table *table = this->shard_of(i).table.load(std::memory_order_seq_cst);
+  auto find = table->find(i);
+  if (find == table->end()) {
     return nullptr;
   }
-  return find->second.get();
+  return find->second;
 }
 
-bool ClientManager::has_capacity() {
-  return this->MAXCLIENTS > this->tcp_clients_.size();
+std::vector<ChannelHandle> ChannelManager::all_channels() const {
+  Epoch::Guard guard;
+  std::vector<ChannelHandle> channels;
+  channels.reserve(this->count_.load());
+  for (const auto &shard : this->shards_) {
+    const Table *table = shard.table.load(std::memory_order_seq_cst);
+    for (const auto &[id, channel] : *table) {
+      channels.push_back(channel);
+    }
+  }
+  return channels;
 }
 
-int ClientManager::add_client(int fd) {
-  int clientId = this->clientIds;
-  auto sclient = std::make_shared<Client>(fd, clientId);
-  this->clientIds.fetch_add(1);
-  std::unique_lock lock(this->mutex);
-  this->tcp_clients_.emplace(fd, std::move(sclient));
-  return clientId;
+bool ClientManager::has_capacity() {
+  std::shared_lock lock(this->mutex);
+  return this->MAXCLIENTS > this->count_;
 }
 
-int ClientManager::add_client(ws_handle hdl) {
-  int clientId = this->clientIds;
-  auto sclient = std::make_shared<Client>(clientId, hdl);
-  this->clientIds.fetch_add(1);
-  std::unique_lock lock(this->mutex);
-  this->ws_clients_.emplace(hdl, std::move(sclient));
-  return clientId;
+uint32_t ClientManager::allocate() {
+  uint32_t slot;
+  if (!this->free_.empty()) {
+    slot = this->free_.back();
+    this->free_.pop_back();
+  } else {
+    slot = this->slab_.size();
+    this->slab_.emplace_back();
+  }
+
+  this->count_++;
+  return (this->slab_[slot].generation << SLOT_BITS) | slot;
 }
 
-void ClientManager::remove_client(ws_handle &hdl) {
+ClientHandle ClientManager::add_client(int fd) {
   std::unique_lock lock(this->mutex);
-  this->ws_clients_.erase(hdl);
+  if (this->slab_.size() > SLOT_MASK && this->free_.empty())
+    return nullptr;
+
+  uint32_t id = this->allocate();
+  auto &session = this->slab_[slot_of(id)];
+  session.client = std::make_shared<Client>(fd, id);
+  if (static_cast<size_t>(fd) >= this->fds_.size())
+    this->fds_.resize(fd + 1, 0);
+  this->fds_[fd] = id;
+  return session.client;
 }
 
-void ClientManager::remove_client(uint32_t fd) {
+ClientHandle ClientManager::add_client(ws_handle hdl,
+                                       websocket_server *endpoint) {
+  const void *key = ws_key(hdl);
   std::unique_lock lock(this->mutex);
-  this->tcp_clients_.erase(fd);
+  if (this->slab_.size() > SLOT_MASK && this->free_.empty())
+    return nullptr;
+
+  uint32_t id = this->allocate();
+  auto &session = this->slab_[slot_of(id)];
+  session.client = std::make_shared<Client>(id, hdl, endpoint);
+  session.ws_key = key;
+  // a connection freed before its session was removed may have left its
+  // address behind, the new connection takes it over
+  this->ws_ids_[key] = id;
+  return session.client;
 }
 
-std::optional<std::shared_ptr<Client>>
-ClientManager::find_client(uint32_t fd) const {
-  auto find = this->tcp_clients_.find(fd);
-  if (find == this->tcp_clients_.end()) {
-    return std::nullopt;
+void ClientManager::remove_client(uint32_t id) {
+  ClientHandle removed;
+  {
+    std::unique_lock lock(this->mutex);
+    uint32_t slot = slot_of(id);
+    if (slot == 0 || slot >= this->slab_.size())
+      return;
+    auto &session = this->slab_[slot];
+    if (session.client == nullptr || session.client->id != id)
+      return;
+
+    int fd = session.client->fd;
+    if (fd != -1 && this->fds_[fd] == id)
+      this->fds_[fd] = 0;
+    if (session.ws_key != nullptr) {
+      auto find = this->ws_ids_.find(session.ws_key);
+      if (find != this->ws_ids_.end() && find->second == id)
+        this->ws_ids_.erase(find);
+    }
+
+    removed = std::move(session.client);
+    session.ws_key = nullptr;
+    session.generation = (session.generation + 1) & (~0u >> SLOT_BITS);
+    this->free_.push_back(slot);
+    this->count_--;
   }
-  return find->second;
+  // the client (and its fd) may go with the last handle, outside the lock
+}
+
+ClientHandle ClientManager::find_client(uint32_t id) const {
+  std::shared_lock lock(this->mutex);
+  uint32_t slot = slot_of(id);
+  if (slot >= this->slab_.size())
+    return nullptr;
+  const auto &session = this->slab_[slot];
+  if (session.client == nullptr || session.client->id != id)
+    return nullptr;
+  return session.client;
+}
+
+ClientHandle ClientManager::find_by_fd(int fd) const {
+  std::shared_lock lock(this->mutex);
+  if (fd < 0 || static_cast<size_t>(fd) >= this->fds_.size() ||
+      this->fds_[fd] == 0)
+    return nullptr;
+  return this->slab_[slot_of(this->fds_[fd])].client;
 }
 
-std::optional<std::shared_ptr<Client>>
-ClientManager::find_client(ws_handle &hdl) const {
-  auto find = this->ws_clients_.find(hdl);
-  if (find == this->ws_clients_.end()) {
-    return std::nullopt;
+ClientHandle ClientManager::find_client(ws_handle &hdl) const {
+  const void *key = ws_key(hdl);
+  std::shared_lock lock(this->mutex);
+  auto find = this->ws_ids_.find(key);
+  if (find == this->ws_ids_.end()) {
+    return nullptr;
   }
-  return find->second;
+  return this->slab_[slot_of(find->second)].client;
 }
 
 std::vector<ChannelView> ChannelManager::get_views() {
   std::vector<ChannelView> views;
-  for (const auto &[key, value] : this->channels) {
-    auto view = value->get_view();
-    views.push_back(view);
+  for (const auto &channel : this->all_channels()) {
+    views.push_back(channel->get_view());
   }
   return views;
 }
 
 std::vector<char> ChannelManager::create_channel(std::string name,
                                                  bool secret) {
-  auto channel = std::make_unique<Channel>(this->channel_id_tracker_, name);
+  uint32_t id = this->channel_id_tracker_.fetch_add(1);
+  auto channel = std::make_shared<Channel>(id, name);
   spdlog::debug("New channel created: {}:{}", channel->id, channel->name);
-  this->channel_id_tracker_.fetch_add(1);
   channel->secret.exchange(secret);
   auto info = channel->info();
 
-  this->channels.emplace(channel->id, std::move(channel));
+  auto &shard = this->shard_of(id);
+  const Table *replaced;
+  {
+    std::unique_lock lock(shard.write_mtx);
+    auto *updated = new Table(*shard.table.load(std::memory_order_relaxed));
+    updated->emplace(id, std::move(channel));
+    this->count_.fetch_add(1);
+    replaced = replace_table(shard, updated);
+    this->directory_.upsert(id, secret, name);
+  }
+  retire_table(replaced);
   return info;
 }
+
+void ChannelManager::reserve_ids(uint32_t last) {
+  int next = this->channel_id_tracker_.load();
+  while (next <= static_cast<int>(last) &&
+         !this->channel_id_tracker_.compare_exchange_weak(next, last + 1)) {
+  }
+}
+
+std::vector<ChannelRecord> ChannelManager::records() {
+  std::vector<ChannelRecord> records;
+  for (const auto &channel : this->all_channels()) {
+    std::unique_lock lock(channel->mtx);
+    records.push_back({channel->id, channel->secret.load(),
+                       channel->packetIds.load(), channel->name,
+                       channel->pinnedMessage});
+  }
+  std::sort(records.begin(), records.end(),
+            [](const auto &a, const auto &b) { return a.id < b.id; });
+  return records;
+}
+
+size_t ChannelManager::restore(const std::vector<ChannelRecord> &records) {
+  std::vector<ChannelHandle> restored[SHARDS];
+  uint32_t last = 0;
+  for (const auto &record : records) {
+    auto channel = std::make_shared<Channel>(record.id, record.name);
+    channel->secret.store(record.secret);
+    channel->packetIds.store(record.next_seq);
+    channel->pinnedMessage = record.pinned;
+    restored[record.id % SHARDS].push_back(std::move(channel));
+    last = std::max(last, record.id);
+  }
+
+  size_t added = 0;
+  for (size_t i = 0; i < SHARDS; i++) {
+    if (restored[i].empty())
+      continue;
+
+    auto &shard = this->shards_[i];
+    const Table *replaced;
+    {
+      std::unique_lock lock(shard.write_mtx);
+      auto *updated = new Table(*shard.table.load(std::memory_order_relaxed));
+      updated->reserve(updated->size() + restored[i].size());
+      for (auto &channel : restored[i]) {
+        uint32_t id = channel->id;
+        bool secret = channel->secret.load();
+        std::string_view name = channel->name;
+        if (updated->emplace(id, std::move(channel)).second) {
+          this->directory_.upsert(id, secret, name);
+          this->count_.fetch_add(1);
+          added++;
+        }
+      }
+      replaced = replace_table(shard, updated);
+    }
+    retire_table(replaced);
+  }
+
+  this->reserve_ids(last);
+  return added;
+}
+
+std::vector<std::pair<uint32_t, size_t>> ChannelManager::queue_depths() {
+  std::vector<std::pair<uint32_t, size_t>> depths;
+  for (const auto &channel : this->all_channels()) {
+    depths.emplace_back(channel->id, channel->queue_depth());
+  }
+  return depths;
+}
+
+std::vector<std::pair<uint32_t, size_t>> ChannelManager::history_bytes() {
+  std::vector<std::pair<uint32_t, size_t>> bytes;
+  for (const auto &channel : this->all_channels()) {
+    bytes.emplace_back(channel->id, channel->history_bytes());
+  }
+  return bytes;
+}
+
+size_t ClientManager::size() const {
+  std::shared_lock lock(this->mutex);
+  return this->count_;
+}
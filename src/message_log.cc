@@ -0,0 +1,597 @@
+#include "message_log.hh"
+#include "configurations.hh"
+#include "frame_pool.hh"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <shared_mutex>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct IndexEntry {
+  uint32_t id;
+  uint32_t offset;
+  // CRC32C of the whole frame, so recovery catches a torn frame too
+  uint32_t crc;
+};
+
+constexpr auto CRC32C_TABLE = []() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+    table[i] = crc;
+  }
+  return table;
+}();
+
+uint32_t crc32c(const char *bytes, size_t size) {
+  uint32_t crc = ~0u;
+  for (size_t i = 0; i < size; i++)
+    crc = CRC32C_TABLE[(crc ^ static_cast<uint8_t>(bytes[i])) & 0xFF] ^
+          (crc >> 8);
+  return ~crc;
+}
+
+size_t page_size() {
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+// msync of [from, to) of a mapping, widened to whole pages.
+void sync_range(char *base, size_t from, size_t to) {
+  if (from >= to)
+    return;
+  size_t start = from & ~(page_size() - 1);
+  msync(base + start, to - start, MS_SYNC);
+}
+
+template <typename T> T *map(int fd, size_t bytes, int prot) {
+  void *addr = mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+  return addr == MAP_FAILED ? nullptr : static_cast<T *>(addr);
+}
+
+// A sealed segment mapped for one read, unmapped when it goes.
+class Mapping {
+public:
+  const char *data{nullptr};
+  const IndexEntry *index{nullptr};
+
+  Mapping() = default;
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+
+  ~Mapping() {
+    if (this->data != nullptr)
+      munmap(const_cast<char *>(this->data), this->data_bytes_);
+    if (this->index != nullptr)
+      munmap(const_cast<IndexEntry *>(this->index), this->index_bytes_);
+  }
+
+  // The mappings outlive the descriptors.
+  bool open(const std::filesystem::path &base, size_t data_bytes,
+            size_t index_bytes) {
+    auto data_file = base;
+    auto index_file = base;
+    data_file += ".log";
+    index_file += ".idx";
+    int data_fd = ::open(data_file.c_str(), O_RDONLY | O_CLOEXEC);
+    int index_fd = ::open(index_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (data_fd != -1 && index_fd != -1) {
+      this->data_bytes_ = data_bytes;
+      this->index_bytes_ = index_bytes;
+      this->data = map<const char>(data_fd, data_bytes, PROT_READ);
+      this->index = map<const IndexEntry>(index_fd, index_bytes, PROT_READ);
+    }
+    if (data_fd != -1)
+      close(data_fd);
+    if (index_fd != -1)
+      close(index_fd);
+    return this->data != nullptr && this->index != nullptr;
+  }
+
+private:
+  size_t data_bytes_{0};
+  size_t index_bytes_{0};
+};
+
+// New directory entries only survive a crash once the directory is synced.
+void sync_directory(const std::filesystem::path &dir) {
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+} // namespace
+
+/* A segment holds its descriptors and mappings only while it takes writes.
+ * Once sealed, its files are closed and, with the channel's lock held
+ * exclusively, unmapped; a read maps it again for as long as it needs it.
+ * Sealed segments cost no descriptor and no address space however many
+ * pile up.
+ */
+struct MessageLog::Segment {
+  // the files' path without the extension
+  std::filesystem::path base;
+  uint32_t first{0};
+  int data_fd{-1};
+  int index_fd{-1};
+  // null once sealed and unmapped, changed under the channel's lock
+  char *data{nullptr};
+  IndexEntry *index{nullptr};
+  size_t data_capacity{0};
+  size_t index_capacity{0};
+
+  // writer side, final once sealed
+  size_t end{0};
+  size_t entries{0};
+  size_t synced_end{0};
+  size_t synced_entries{0};
+  uint32_t last{0};
+  bool sealed{false};
+
+  // index entries readers may use, all synced
+  std::atomic_size_t committed{0};
+
+  ~Segment() {
+    this->unmap();
+    this->close_files();
+  }
+
+  void close_files() {
+    if (this->data_fd != -1)
+      close(this->data_fd);
+    if (this->index_fd != -1)
+      close(this->index_fd);
+    this->data_fd = this->index_fd = -1;
+  }
+
+  void unmap() {
+    if (this->data != nullptr)
+      munmap(this->data, this->data_capacity);
+    if (this->index != nullptr)
+      munmap(this->index, this->index_capacity * sizeof(IndexEntry));
+    this->data = nullptr;
+    this->index = nullptr;
+  }
+
+  // Makes everything written so far durable, data before index, then lets
+  // readers see it.
+  void sync() {
+    if (this->synced_entries == this->entries)
+      return;
+    sync_range(this->data, this->synced_end, this->end);
+    sync_range(reinterpret_cast<char *>(this->index),
+               this->synced_entries * sizeof(IndexEntry),
+               this->entries * sizeof(IndexEntry));
+    this->synced_end = this->end;
+    this->synced_entries = this->entries;
+    this->committed.store(this->entries, std::memory_order_release);
+  }
+
+  // Trims the files to what the segment holds and closes them, it takes no
+  // more writes. Readers never look past `end`, so the longer mappings stay
+  // valid until unmap().
+  void seal() {
+    this->sync();
+    if (ftruncate(this->data_fd, this->end) != 0 ||
+        ftruncate(this->index_fd, this->entries * sizeof(IndexEntry)) != 0) {
+      spdlog::warn("message log: could not trim segment {}", this->first);
+    }
+    this->close_files();
+    this->sealed = true;
+  }
+
+  // Maps a sealed segment for a read.
+  bool map_sealed(Mapping &mapping) const {
+    return mapping.open(this->base, this->end,
+                        this->entries * sizeof(IndexEntry));
+  }
+
+  bool open_files(const std::filesystem::path &dir, uint32_t first,
+                  int flags) {
+    this->base = dir / std::format("{:010}", first);
+    this->first = first;
+    auto data_file = this->base;
+    auto index_file = this->base;
+    data_file += ".log";
+    index_file += ".idx";
+    this->data_fd = open(data_file.c_str(), flags, 0644);
+    this->index_fd = open(index_file.c_str(), flags, 0644);
+    return this->data_fd != -1 && this->index_fd != -1;
+  }
+
+  // A new segment whose first frame is `first`, files sized and mapped.
+  static std::unique_ptr<Segment>
+  create(const std::filesystem::path &dir, uint32_t first, size_t bytes) {
+    auto segment = std::make_unique<Segment>();
+    if (!segment->open_files(dir, first,
+                             O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC))
+      return nullptr;
+
+    segment->data_capacity = bytes;
+    segment->index_capacity = bytes / (4 + MIN_FRAME_SIZE);
+    if (ftruncate(segment->data_fd, segment->data_capacity) != 0 ||
+        ftruncate(segment->index_fd,
+                  segment->index_capacity * sizeof(IndexEntry)) != 0)
+      return nullptr;
+
+    segment->data = map<char>(segment->data_fd, segment->data_capacity,
+                              PROT_READ | PROT_WRITE);
+    segment->index =
+        map<IndexEntry>(segment->index_fd,
+                        segment->index_capacity * sizeof(IndexEntry),
+                        PROT_READ | PROT_WRITE);
+    if (segment->data == nullptr || segment->index == nullptr)
+      return nullptr;
+    sync_directory(dir);
+    return segment;
+  }
+
+  /* Reopens a segment left by an earlier run, sealed.
+   *
+   * Only syncs order writes, the kernel may have written any dirty page
+   * before a crash. An entry is kept if its id follows the previous one,
+   * its offset is where the previous frame ends and the frame there
+   * carries the same id and matches the entry's checksum. Recovery stops
+   * at the first entry that doesn't, so what's left is a prefix of what
+   * was appended.
+   */
+  static std::unique_ptr<Segment>
+  recover(const std::filesystem::path &dir, uint32_t first, uint32_t after) {
+    auto segment = std::make_unique<Segment>();
+    if (!segment->open_files(dir, first, O_RDWR | O_CLOEXEC))
+      return nullptr;
+
+    struct stat data_stat {};
+    struct stat index_stat {};
+    fstat(segment->data_fd, &data_stat);
+    fstat(segment->index_fd, &index_stat);
+    segment->data_capacity = data_stat.st_size;
+    segment->index_capacity = index_stat.st_size / sizeof(IndexEntry);
+    if (segment->data_capacity == 0 || segment->index_capacity == 0)
+      return nullptr;
+
+    segment->data =
+        map<char>(segment->data_fd, segment->data_capacity, PROT_READ);
+    segment->index = map<IndexEntry>(
+        segment->index_fd, segment->index_capacity * sizeof(IndexEntry),
+        PROT_READ);
+    if (segment->data == nullptr || segment->index == nullptr)
+      return nullptr;
+
+    size_t end = 0;
+    size_t entries = 0;
+    uint32_t last = after;
+    while (entries < segment->index_capacity) {
+      auto entry = segment->index[entries];
+      if (entry.id <= last || entry.offset != end ||
+          end + 4 + MIN_FRAME_SIZE > segment->data_capacity)
+        break;
+
+      uint32_t size;
+      uint32_t id;
+      std::memcpy(&size, segment->data + end, 4);
+      std::memcpy(&id, segment->data + end + 4, 4);
+      if (size < MIN_FRAME_SIZE || end + 4 + size > segment->data_capacity ||
+          id != entry.id || crc32c(segment->data + end, 4 + size) != entry.crc)
+        break;
+
+      end += 4 + size;
+      last = entry.id;
+      entries++;
+    }
+    if (entries == 0)
+      return nullptr;
+
+    segment->end = segment->synced_end = end;
+    segment->entries = segment->synced_entries = entries;
+    segment->last = last;
+    segment->committed.store(entries, std::memory_order_relaxed);
+    segment->seal();
+    // nobody reads it yet
+    segment->unmap();
+    return segment;
+  }
+
+  // Id of the last committed entry, the channel's lock held.
+  inline uint32_t last_committed(size_t committed) const {
+    return this->index != nullptr ? this->index[committed - 1].id
+                                  : this->last;
+  }
+};
+
+struct MessageLog::ChannelLog {
+  std::filesystem::path dir;
+  // the writer takes it exclusively to add a segment, readers shared
+  mutable std::shared_mutex mtx;
+  std::vector<std::unique_ptr<Segment>> segments{};
+  // writer side, frames must come in id order
+  uint32_t last_id{0};
+};
+
+MessageLog::MessageLog(std::filesystem::path dir, size_t segment_bytes)
+    : dir_(std::move(dir)),
+      segment_bytes_(std::max<size_t>(segment_bytes, 4 + MAX_FRAME_SIZE)) {
+  this->recover();
+  this->writer_ = std::thread([this]() { this->write_loop(); });
+}
+
+MessageLog::~MessageLog() {
+  {
+    std::unique_lock lock(this->pending_mtx_);
+    this->stop_ = true;
+  }
+  this->pending_cv_.notify_one();
+  if (this->writer_.joinable())
+    this->writer_.join();
+}
+
+void MessageLog::recover() {
+  std::filesystem::create_directories(this->dir_);
+  for (const auto &entry : std::filesystem::directory_iterator(this->dir_)) {
+    auto name = entry.path().filename().string();
+    uint32_t channel;
+    auto [end, ec] =
+        std::from_chars(name.data(), name.data() + name.size(), channel);
+    if (!entry.is_directory() || ec != std::errc() ||
+        end != name.data() + name.size())
+      continue;
+
+    // zero padded names, so name order is id order
+    std::vector<std::string> stems;
+    for (const auto &file : std::filesystem::directory_iterator(entry)) {
+      if (file.path().extension() == ".log")
+        stems.push_back(file.path().stem().string());
+    }
+    std::sort(stems.begin(), stems.end());
+
+    auto log = std::make_shared<ChannelLog>();
+    log->dir = entry.path();
+    for (const auto &stem : stems) {
+      uint32_t first = 0;
+      std::from_chars(stem.data(), stem.data() + stem.size(), first);
+      auto segment = Segment::recover(log->dir, first, log->last_id);
+      if (segment == nullptr) {
+        spdlog::warn("message log: dropping empty segment {}/{}", channel,
+                     stem);
+        std::filesystem::remove(log->dir / (stem + ".log"));
+        std::filesystem::remove(log->dir / (stem + ".idx"));
+        continue;
+      }
+      log->last_id = segment->last;
+      log->segments.push_back(std::move(segment));
+    }
+    this->channels_.emplace(channel, std::move(log));
+  }
+}
+
+MessageLog::ChannelLog &MessageLog::channel_log(uint32_t channel) {
+  std::unique_lock lock(this->channels_mtx_);
+  auto &log = this->channels_[channel];
+  if (log == nullptr) {
+    log = std::make_shared<ChannelLog>();
+    log->dir = this->dir_ / std::to_string(channel);
+    std::filesystem::create_directories(log->dir);
+    sync_directory(this->dir_);
+  }
+  return *log;
+}
+
+bool MessageLog::append(uint32_t channel, const shared_frame &frame) {
+  bool idle;
+  {
+    std::unique_lock lock(this->pending_mtx_);
+    if (this->pending_bytes_ + frame->size() > MAX_PENDING_BYTES) {
+      this->dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    idle = this->pending_.empty();
+    this->pending_.push_back({channel, frame});
+    this->pending_bytes_ += frame->size();
+    this->queued_++;
+  }
+  this->appended_.fetch_add(1, std::memory_order_relaxed);
+  // the writer only sleeps on an empty queue
+  if (idle)
+    this->pending_cv_.notify_one();
+  return true;
+}
+
+MessageLog::Segment *MessageLog::write(uint32_t channel,
+                                       const shared_frame &frame) {
+  auto &log = this->channel_log(channel);
+  uint32_t id;
+  std::memcpy(&id, frame->data() + 4, sizeof(id));
+  if (id <= log.last_id || frame->size() > this->segment_bytes_) {
+    spdlog::warn("message log: can't log {} in channel {}", id, channel);
+    this->dropped_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Segment *segment =
+      log.segments.empty() ? nullptr : log.segments.back().get();
+  if (segment == nullptr || segment->sealed ||
+      segment->end + frame->size() > segment->data_capacity ||
+      segment->entries == segment->index_capacity) {
+    Segment *full = segment != nullptr && !segment->sealed ? segment : nullptr;
+    if (full != nullptr)
+      full->seal();
+
+    auto created = Segment::create(log.dir, id, this->segment_bytes_);
+    std::unique_lock lock(log.mtx);
+    // no reader is in it now, later ones map it themselves
+    if (full != nullptr)
+      full->unmap();
+    if (created == nullptr) {
+      spdlog::error("message log: could not create a segment in {}: {}",
+                    log.dir.string(), std::strerror(errno));
+      this->dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    segment = created.get();
+    log.segments.push_back(std::move(created));
+  }
+
+  std::memcpy(segment->data + segment->end, frame->data(), frame->size());
+  segment->index[segment->entries++] = {
+      id, static_cast<uint32_t>(segment->end),
+      crc32c(frame->data(), frame->size())};
+  segment->end += frame->size();
+  segment->last = id;
+  log.last_id = id;
+  return segment;
+}
+
+/* Group commit: takes everything queued, writes it, then syncs each segment
+ * written to once. Appends that arrive meanwhile make up the next group, so
+ * the busier the log the bigger the groups.
+ */
+void MessageLog::write_loop() {
+  std::vector<Pending> group;
+  std::vector<Segment *> touched;
+  while (true) {
+    uint64_t queued;
+    {
+      std::unique_lock lock(this->pending_mtx_);
+      this->pending_cv_.wait(lock, [this]() {
+        return this->stop_ || !this->pending_.empty();
+      });
+      if (this->pending_.empty())
+        return;
+      group.swap(this->pending_);
+      queued = this->queued_;
+    }
+
+    size_t bytes = 0;
+    for (const auto &pending : group) {
+      bytes += pending.frame->size();
+      auto *segment = this->write(pending.channel, pending.frame);
+      // first write to the segment in this group
+      if (segment != nullptr &&
+          segment->entries == segment->synced_entries + 1)
+        touched.push_back(segment);
+    }
+    for (auto *segment : touched)
+      segment->sync();
+    touched.clear();
+    group.clear();
+    this->commits_.fetch_add(1, std::memory_order_relaxed);
+
+    {
+      std::unique_lock lock(this->pending_mtx_);
+      this->pending_bytes_ -= bytes;
+      this->written_ = queued;
+    }
+    this->synced_cv_.notify_all();
+  }
+}
+
+void MessageLog::sync() {
+  std::unique_lock lock(this->pending_mtx_);
+  uint64_t target = this->queued_;
+  this->synced_cv_.wait(lock,
+                        [this, target]() { return this->written_ >= target; });
+}
+
+std::vector<shared_frame> MessageLog::read(uint32_t channel, uint32_t after,
+                                           size_t count) const {
+  std::shared_ptr<const ChannelLog> log;
+  {
+    std::unique_lock lock(this->channels_mtx_);
+    auto find = this->channels_.find(channel);
+    if (find == this->channels_.end())
+      return {};
+    log = find->second;
+  }
+
+  std::vector<shared_frame> frames;
+  std::shared_lock lock(log->mtx);
+  for (const auto &segment : log->segments) {
+    size_t committed = segment->committed.load(std::memory_order_acquire);
+    if (committed == 0 || segment->last_committed(committed) <= after)
+      continue;
+
+    Mapping mapping;
+    const char *data = segment->data;
+    const IndexEntry *begin = segment->index;
+    if (data == nullptr) {
+      if (!segment->map_sealed(mapping)) {
+        spdlog::error("message log: could not map segment {} of channel {}",
+                      segment->first, channel);
+        return frames;
+      }
+      data = mapping.data;
+      begin = mapping.index;
+    }
+    const IndexEntry *end = begin + committed;
+    const IndexEntry *at = std::upper_bound(
+        begin, end, after,
+        [](uint32_t id, const IndexEntry &entry) { return id < entry.id; });
+    for (; at != end; at++) {
+      if (frames.size() == count)
+        return frames;
+      uint32_t size;
+      std::memcpy(&size, data + at->offset, 4);
+      auto frame = FramePool::acquire(size + 4);
+      std::memcpy(frame.get()->data(), data + at->offset, size + 4);
+      frames.push_back(std::move(frame));
+    }
+  }
+  return frames;
+}
+
+uint32_t MessageLog::last_id(uint32_t channel) const {
+  std::shared_ptr<const ChannelLog> log;
+  {
+    std::unique_lock lock(this->channels_mtx_);
+    auto find = this->channels_.find(channel);
+    if (find == this->channels_.end())
+      return 0;
+    log = find->second;
+  }
+
+  std::shared_lock lock(log->mtx);
+  for (auto at = log->segments.rbegin(); at != log->segments.rend(); at++) {
+    size_t committed = (*at)->committed.load(std::memory_order_acquire);
+    if (committed > 0)
+      return (*at)->last_committed(committed);
+  }
+  return 0;
+}
+
+uint32_t MessageLog::last_channel() const {
+  std::unique_lock lock(this->channels_mtx_);
+  uint32_t last = 0;
+  for (const auto &[channel, log] : this->channels_)
+    last = std::max(last, channel);
+  return last;
+}
+
+MessageLog::Stats MessageLog::stats() const {
+  Stats stats{};
+  stats.appended = this->appended_.load(std::memory_order_relaxed);
+  stats.dropped = this->dropped_.load(std::memory_order_relaxed);
+  stats.commits = this->commits_.load(std::memory_order_relaxed);
+  std::unique_lock lock(this->pending_mtx_);
+  stats.pending_bytes = this->pending_bytes_;
+  return stats;
+}
+
+MessageLog *MessageLog::instance() {
+  static std::unique_ptr<MessageLog> log = []() {
+    auto dir = ServerConfiguration::instance().data_dir();
+    return dir.empty() ? nullptr : std::make_unique<MessageLog>(dir);
+  }();
+  return log.get();
+}
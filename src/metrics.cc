@@ -0,0 +1,208 @@
+#include "metrics.hh"
+#include "frame_pool.hh"
+#include "managers.hh"
+#include "message_log.hh"
+#include "thread_pool.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Per-channel queue depths listed in a scrape, deepest first.
+constexpr size_t CHANNELS_LISTED = 32;
+
+std::atomic<MetricShard *> shards{nullptr};
+
+std::string_view packet_name(uint32_t type) {
+  switch (type) {
+  case 0x01:
+    return "SVR_CONNECT";
+  case 0x02:
+    return "SVR_DISCONNECT";
+  case 0x03:
+    return "SVR_MESSAGE";
+  case 0x04:
+    return "SVR_BANNED";
+  case 0x05:
+    return "SVR_SHUTDOWN";
+  case 0x06:
+    return "SVR_STATS";
+  case 0x10:
+    return "CH_JOIN";
+  case 0x11:
+    return "CH_LEAVE";
+  case 0x12:
+    return "CH_MESSAGE";
+  case 0x13:
+    return "CH_UPDATE";
+  case 0x14:
+    return "CH_DELETE";
+  case 0x15:
+    return "CH_CREATE";
+  case 0x16:
+    return "CH_LIST";
+  case 0x17:
+    return "CH_MESSAGE_BATCH";
+  case 0x18:
+    return "CH_MESSAGE_BUNDLE";
+  case 0x20:
+    return "CH_INVITE";
+  case 0x21:
+    return "CH_KICK";
+  case 0x22:
+    return "CH_BAN";
+  case 0x23:
+    return "CH_UNBAN";
+  case 0xF0:
+    return "REQUEST_REJECTED";
+  case 0xF1:
+    return "PERMISSION_DENIED";
+  case 0xF2:
+    return "NOT_FOUND";
+  case 0xFE:
+    return "HEARTBEAT";
+  case 0xFF:
+    return "ERROR";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+} // namespace
+
+MetricShard *Metrics::register_shard() {
+  auto *shard = new MetricShard();
+  shard->next = shards.load(std::memory_order_relaxed);
+  while (!shards.compare_exchange_weak(shard->next, shard,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed))
+    ;
+  return shard;
+}
+
+Metrics::Totals Metrics::totals() {
+  Totals totals;
+  for (auto *shard = shards.load(std::memory_order_acquire); shard != nullptr;
+       shard = shard->next) {
+    for (size_t t = 0; t < MetricShard::TYPES; t++) {
+      totals.packets_in[t] +=
+          shard->packets_in[t].load(std::memory_order_relaxed);
+      totals.packets_out[t] +=
+          shard->packets_out[t].load(std::memory_order_relaxed);
+    }
+    for (size_t c = 0; c < static_cast<size_t>(COUNTER::COUNT); c++) {
+      totals.counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+    }
+    for (size_t s = 0; s < MetricShard::STAGES; s++) {
+      auto &histogram = totals.stages[s];
+      for (size_t b = 0; b < HistogramBuckets::COUNT; b++) {
+        if (auto n = shard->latency[s][b].load(std::memory_order_relaxed))
+          histogram.add(b, n);
+      }
+      histogram.add_sum(shard->latency_sum[s].load(std::memory_order_relaxed),
+                        shard->latency_max[s].load(std::memory_order_relaxed));
+    }
+  }
+  return totals;
+}
+
+std::string Metrics::render() {
+  auto totals = Metrics::totals();
+  std::string out;
+  auto line = std::back_inserter(out);
+
+  auto packets = [&](std::string_view name, const uint64_t *counts) {
+    std::format_to(line, "# TYPE {} counter\n", name);
+    for (uint32_t t = 0; t < MetricShard::TYPES; t++) {
+      if (counts[t] != 0)
+        std::format_to(line, "{}{{type=\"{}\"}} {}\n", name, packet_name(t),
+                       counts[t]);
+    }
+  };
+  auto metric = [&](std::string_view name, std::string_view type,
+                    uint64_t value) {
+    std::format_to(line, "# TYPE {} {}\n{} {}\n", name, type, name, value);
+  };
+
+  packets("relay_packets_in_total", totals.packets_in);
+  packets("relay_packets_out_total", totals.packets_out);
+  metric("relay_bytes_in_total", "counter", totals[COUNTER::BYTES_IN]);
+  metric("relay_bytes_out_total", "counter", totals[COUNTER::BYTES_OUT]);
+  metric("relay_connections_accepted_total", "counter",
+         totals[COUNTER::ACCEPTED]);
+  metric("relay_connections_rejected_total", "counter",
+         totals[COUNTER::REJECTED]);
+  metric("relay_send_failures_total", "counter",
+         totals[COUNTER::SEND_FAILURES]);
+
+  metric("relay_clients", "gauge", ClientManager::instance().size());
+  metric("relay_thread_pool_queue_depth", "gauge",
+         ThreadPool::initialize().queued());
+
+  // the CHANNELS_LISTED biggest non-zero values, one series per channel
+  auto per_channel = [&](std::string_view name,
+                         std::vector<std::pair<uint32_t, size_t>> values) {
+    std::erase_if(values, [](const auto &entry) { return entry.second == 0; });
+    size_t listed = std::min(values.size(), CHANNELS_LISTED);
+    std::partial_sort(
+        values.begin(), values.begin() + listed, values.end(),
+        [](const auto &a, const auto &b) { return a.second > b.second; });
+    std::format_to(line, "# TYPE {} gauge\n", name);
+    for (size_t i = 0; i < listed; i++) {
+      std::format_to(line, "{}{{channel=\"{}\"}} {}\n", name, values[i].first,
+                     values[i].second);
+    }
+  };
+
+  auto &channels = ChannelManager::instance();
+  auto depths = channels.queue_depths();
+  size_t queued = 0;
+  for (auto &[id, depth] : depths)
+    queued += depth;
+  metric("relay_channels", "gauge", depths.size());
+  metric("relay_channel_queue_depth_total", "gauge", queued);
+  per_channel("relay_channel_queue_depth", std::move(depths));
+
+  metric("relay_history_bytes_total", "gauge", History::total_bytes());
+  per_channel("relay_channel_history_bytes", channels.history_bytes());
+
+  if (auto *log = MessageLog::instance()) {
+    auto stats = log->stats();
+    metric("relay_log_appended_total", "counter", stats.appended);
+    metric("relay_log_dropped_total", "counter", stats.dropped);
+    metric("relay_log_commits_total", "counter", stats.commits);
+    metric("relay_log_pending_bytes", "gauge", stats.pending_bytes);
+  }
+
+  constexpr std::string_view STAGE_NAMES[] = {"wakeup", "handle", "queue",
+                                               "send"};
+  constexpr double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+  std::format_to(line, "# TYPE relay_stage_latency_seconds summary\n");
+  for (size_t s = 0; s < MetricShard::STAGES; s++) {
+    auto &histogram = totals.stages[s];
+    for (double q : QUANTILES) {
+      std::format_to(line,
+                     "relay_stage_latency_seconds{{stage=\"{}\",quantile="
+                     "\"{}\"}} {:.9f}\n",
+                     STAGE_NAMES[s], q, histogram.percentile(q) / 1e9);
+    }
+    std::format_to(line, "relay_stage_latency_seconds_sum{{stage=\"{}\"}} "
+                   "{:.9f}\n", STAGE_NAMES[s], histogram.sum() / 1e9);
+    std::format_to(line, "relay_stage_latency_seconds_count{{stage=\"{}\"}} "
+                   "{}\n", STAGE_NAMES[s], histogram.count());
+  }
+
+  auto frames = FramePool::stats();
+  metric("relay_frame_allocations_total", "counter", frames.allocations);
+  metric("relay_frame_frees_total", "counter", frames.frees);
+  metric("relay_frame_oversized_total", "counter", frames.oversized);
+  return out;
+}
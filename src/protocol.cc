@@ -1,14 +1,20 @@
 #include "protocol.hh"
 #include "managers.hh"
+#include "metrics.hh"
 #include "typedef.hh"
 #include "utilities.hh"
 #include <cstdint>
+#include <format>
 #include <spdlog/spdlog.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 Response Protocol::handle_request(const std::shared_ptr<Client> s_client,
                                   const Request &request) {
+  // size prefix, id, type, payload and the two NUL bytes
+  Metrics::packet_in(request.type, request.payload.size() + 14);
+
   if (!s_client->connected) {
     if (SVR_CONNECT != request.type) {
       spdlog::debug("not connect request {}", s_client->id);
@@ -26,25 +32,56 @@ Response Protocol::handle_request(const std::shared_ptr<Client> s_client,
     if (s_client->admin)
       return Protocol::create_channel_request(request);
     return response(-1, PERMISSION_DENIED);
+  case (uint32_t)CH_JOIN:
+    spdlog::debug("CH_JOIN request");
+    return Protocol::channel_join_request(s_client, request);
+  case (uint32_t)CH_LEAVE:
+    spdlog::debug("CH_LEAVE request");
+    return Protocol::channel_disconnect(s_client, request);
   case (uint32_t)CH_MESSAGE:
     spdlog::debug("CH_MESSAGE request");
     return Protocol::channel_message_request(s_client, request);
+  case (uint32_t)CH_MESSAGE_BATCH:
+    spdlog::debug("CH_MESSAGE_BATCH request");
+    return Protocol::channel_message_batch_request(s_client, request);
+  case (uint32_t)SVR_STATS:
+    spdlog::debug("SVR_STATS request");
+    if (s_client->admin)
+      return Protocol::stats_request(request);
+    return response(-1, PERMISSION_DENIED);
   default:
     spdlog::debug("Unknown request type: {}", request.type);
     return response(-1, ERROR, (std::string) "unknown request type");
   }
 }
 
+/* Opens the session.
+ * - Incoming: username[\npassword[\nwire version]]
+ * - Outgoing: the username the client got, followed by "\n2" when the
+ *   session switched to wire format v2 (see WIRE).
+ *
+ * The reply itself is still v1, the client sends v2 once it has it.
+ */
 Response Protocol::handle_server_connection(const w_client w_client,
                                             const Request &request) {
   auto s_client = w_client.lock();
-  auto payload = split(request.payload, '\n');
+  auto payload = split(as_text(request.payload), '\n');
   auto username = s_client->change_username(payload[0]);
   s_client->set_connection(true);
 
-  if (payload.size() == 2)
+  if (payload.size() >= 2)
     s_client->set_admin(payload[1]);
 
+  if (payload.size() >= 3 && payload[2] == "2") {
+    // nothing else is sent to a client before it is connected, so the
+    // reply is the last v1 frame it gets
+    s_client->wire.store(WIRE::V2, std::memory_order_release);
+    s_client->send_encoded(
+        share(response(request.id, SVR_CONNECT, username + "\n2")),
+        WIRE::V1);
+    return Response{};
+  }
+
   return response(request.id, SVR_CONNECT, username);
 }
 
@@ -52,10 +89,8 @@ Response Protocol::handle_server_connection(const w_client w_client,
  * counter to zero.
  *
  * Pointer tracker:
- *  - Server  -> clients::unordered_map
- *  - Channel -> chatters::vector
- *  - Channel -> moderators::vector
- *  - Channel -> emperor::shared_ptr
+ *  - Server  -> ClientManager slab
+ *  - Channel -> members::Membership (weak)
  */
 void Protocol::server_disconnect(const w_client &w_client) {
   auto s_client = w_client.lock();
@@ -65,7 +100,7 @@ void Protocol::server_disconnect(const w_client &w_client) {
   // loop over the client's connected channels
   // find said channels
   // diconnect client from it
-  for (int id : s_client->channels) {
+  for (uint32_t id : s_client->channels.ids()) {
     auto channel = channel_ctx.find_channel(id);
     if (channel != nullptr) {
       channel->leave_channel(s_client);
@@ -73,27 +108,41 @@ void Protocol::server_disconnect(const w_client &w_client) {
     }
   }
 
-  if (s_client->fd == -1) {
-    client_ctx.remove_client(s_client->ws_hld.value());
-  } else {
-    client_ctx.remove_client(s_client->fd);
-  }
+  client_ctx.remove_client(s_client->id);
   spdlog::info("{0} disconnected from the server", s_client->username);
 }
 
 /* Request to join a channel.
+ * - Incoming
+ *    Join {
+ *      channelId = 4 bytes
+ *      replay = 4 bytes (optional), messages to get back from the history
+ *      after = 4 bytes (optional), only the messages sent after this one
+ *    }
+ * - The missed messages follow the join reply in one CH_MESSAGE_BUNDLE (one
+ *   per MAX_FRAME_SIZE) with the request's id, or as a plain CH_MESSAGE when
+ *   there is only one.
  */
 Response Protocol::channel_join_request(const w_client &w_client,
                                         const Request &request) {
-  auto payload = request.payload;
+  const auto payload = request.payload;
+  if (payload.size() < 4)
+    return response(-1, NOT_FOUND, (std::string) "Channel not found.");
+
   int channel_id = i32_from_le(payload);
+  Channel::Replay replay{.request_id = request.id};
+  if (payload.size() >= 8)
+    replay.count = static_cast<uint32_t>(i32_from_le(payload.subspan(4)));
+  if (payload.size() >= 12)
+    replay.after = i32_from_le(payload.subspan(8));
+
   auto &ctx = ChannelManager::instance();
   auto channel = ctx.find_channel(channel_id);
 
   if (channel == nullptr) { // channel doesn't exist...
     return response(-1, NOT_FOUND, (std::string) "Channel not found.");
   } else { // channel exists and the client...
-    auto result = channel->join_channel(w_client);
+    auto result = channel->join_channel(w_client, &replay);
     std::string fr;
 
     switch (result) {
@@ -110,9 +159,9 @@ Response Protocol::channel_join_request(const w_client &w_client,
     case JOINRESULT::SUCCESS:
       auto s_client = w_client.lock();
       s_client->add_channel(channel_id);
-      auto channel_info = channel->info();
       spdlog::debug("{0} joined {1}", s_client->username, channel->name);
-      return ::response(request.id, CH_JOIN, channel_info);
+      // the channel already queued the reply and the replay
+      return Response{};
     }
     return ::response(-1, CH_JOIN, fr);
   }
@@ -125,8 +174,7 @@ Response Protocol::channel_disconnect(const w_client &w_client,
                                       const Request &request) {
   if (request.payload.size() >= 4) {
     auto &ctx = ChannelManager::instance();
-    auto payload = request.payload;
-    auto channel_id = i32_from_le(payload);
+    auto channel_id = i32_from_le(request.payload);
     auto channel = ctx.find_channel(channel_id);
 
     if (channel != nullptr) {
@@ -156,11 +204,12 @@ Response Protocol::channel_message_request(const w_client &w_client,
   auto &ctx = ChannelManager::instance();
 
   const auto payload = request.payload;
+  if (payload.size() < 8)
+    return ::response(-1, CH_MESSAGE);
 
   const auto channel_id = i32_from_le(payload);
-  const auto reply_to =
-      i32_from_le({payload[4], payload[5], payload[6], payload[7]});
-  const std::string message(payload.begin() + 8, payload.end());
+  const auto reply_to = i32_from_le(payload.subspan(4));
+  const auto message = as_text(payload.subspan(8));
   const auto channel = ctx.find_channel(channel_id);
 
   if (channel != nullptr) {
@@ -175,33 +224,129 @@ Response Protocol::channel_message_request(const w_client &w_client,
   return ::response(-1, CH_MESSAGE);
 }
 
+/* Sends a burst of messages in one request, in order.
+ * - Incoming
+ *    Batch {
+ *      Entry {
+ *        channelId = 4 bytes
+ *        replyTo = 4 bytes
+ *        length = 2 bytes
+ *        message = `length` ascii bytes
+ *      } ...
+ *    }
+ * - Outgoing: one byte per entry, 1 if it was queued, 0 if the channel
+ *   doesn't exist or the client isn't in it. A -1 reply when an entry is
+ *   truncated, none of the batch is sent then.
+ */
+Response Protocol::channel_message_batch_request(const w_client &w_client,
+                                                 const Request &request) {
+  auto &ctx = ChannelManager::instance();
+  auto s_client = w_client.lock();
+
+  // the whole batch is checked before any of it is sent, so a truncated
+  // entry rejects it all rather than the part after it
+  size_t entries = 0;
+  for (auto rest = request.payload; !rest.empty(); entries++) {
+    if (rest.size() < 10)
+      return ::response(-1, CH_MESSAGE_BATCH);
+    const uint16_t length = rest[8] | (rest[9] << 8);
+    if (rest.size() < 10u + length)
+      return ::response(-1, CH_MESSAGE_BATCH);
+    rest = rest.subspan(10 + length);
+  }
+
+  std::vector<uint8_t> statuses;
+  statuses.reserve(entries);
+  // bursts mostly go to one channel, look it up once per run
+  uint32_t looked_up = 0;
+  ChannelHandle channel;
+
+  auto payload = request.payload;
+  while (!payload.empty()) {
+    const uint32_t channel_id = i32_from_le(payload);
+    const uint32_t reply_to = i32_from_le(payload.subspan(4));
+    const uint16_t length = payload[8] | (payload[9] << 8);
+    const auto message = as_text(payload.subspan(10, length));
+    payload = payload.subspan(10 + length);
+
+    if (channel_id != looked_up) {
+      looked_up = channel_id;
+      channel = ctx.find_channel(channel_id);
+    }
+    if (channel == nullptr || !s_client->is_member(channel_id)) {
+      statuses.push_back(0);
+      continue;
+    }
+    channel->queue_message(
+        MessageView(s_client->id, channel_id, reply_to, message));
+    statuses.push_back(1);
+  }
+
+  return ::response(request.id, CH_MESSAGE_BATCH, statuses);
+}
+
 Response Protocol::create_channel_request(const Request &request) {
   auto payload = request.payload;
+  if (payload.empty())
+    return response(-1, CH_CREATE);
+
   auto &ctx = ChannelManager::instance();
-  std::string channel_name(payload.begin() + 1, payload.end());
+  std::string channel_name(as_text(payload.subspan(1)));
   bool secret = static_cast<int>(payload[0]) == 1;
   auto info = ctx.create_channel(channel_name, secret);
   return response(request.id, CH_CREATE, info);
 }
 
+/* Payload (optional): page (4), the version of that page the client holds
+ * (4). The page itself is the directory's shared frame, nothing is encoded
+ * here, and a client that is up to date only gets the version back.
+ */
 Response Protocol::list_channels_request(const Request &request) {
-  auto &channel_manager = ChannelManager::instance();
-  auto views = channel_manager.get_views();
-  std::vector<uint8_t> views_bytes;
-  for (auto view : views) {
-    std::string id_str = std::to_string(*view.id);
-    views_bytes.insert(views_bytes.end(), id_str.begin(), id_str.end());
-    views_bytes.push_back('\n');
-
-    views_bytes.push_back(view.secret);
-    views_bytes.push_back('\n');
-
-    views_bytes.insert(views_bytes.end(), view.name->begin(), view.name->end());
-    views_bytes.push_back('\n');
-
-    // View separator (null byte)
-    views_bytes.push_back(0x00);
+  auto payload = request.payload;
+  uint32_t index = payload.size() >= 4 ? i32_from_le(payload) : 0;
+  uint32_t known = payload.size() >= 8 ? i32_from_le(payload.subspan(4)) : 0;
+
+  auto page = ChannelManager::instance().directory().page(index);
+  if (!page.frame)
+    return response(request.id, NOT_FOUND, (std::string) "Page not found.");
+  if (known != 0 && known == page.version)
+    return response(request.id, CH_LIST, raw_bytes(page.version));
+
+  Response listing;
+  listing.id = 0;
+  listing.type = CH_LIST;
+  listing.size = (*page.frame)->size() - 4;
+  listing.data = std::move(*page.frame);
+  return listing;
+}
+
+/* Payload (optional): page (4). The metrics are cut at line ends into pages
+ * that fit one frame, every page but the last ends with a
+ * "# next page N" comment.
+ */
+Response Protocol::stats_request(const Request &request) {
+  // leaves room for the "# next page" line
+  constexpr size_t PAGE_BYTES = MAX_FRAME_SIZE - MIN_FRAME_SIZE - 32;
+  uint32_t page =
+      request.payload.size() >= 4 ? i32_from_le(request.payload) : 0;
+
+  auto text = Metrics::render();
+  std::string_view rest(text);
+  for (uint32_t index = 0; index <= page; index++) {
+    size_t cut = rest.size();
+    if (cut > PAGE_BYTES) {
+      cut = rest.rfind('\n', PAGE_BYTES - 1);
+      cut = cut == std::string_view::npos ? PAGE_BYTES : cut + 1;
+    }
+    if (index == page) {
+      std::string body(rest.substr(0, cut));
+      if (cut < rest.size())
+        body += std::format("# next page {}\n", page + 1);
+      return response(request.id, SVR_STATS, body);
+    }
+    rest.remove_prefix(cut);
+    if (rest.empty())
+      break;
   }
-  views_bytes.push_back(0x00);
-  return response(request.id, CH_LIST, views_bytes);
+  return response(request.id, NOT_FOUND, (std::string) "Page not found.");
 }
@@ -0,0 +1,242 @@
+#include "reactor.hh"
+#include "client.hh"
+#include "managers.hh"
+#include "metrics.hh"
+#include "protocol.hh"
+#include "spdlog/spdlog.h"
+#include "utilities.hh"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <netinet/in.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Creates the reactor's listening socket, every reactor binds the same
+ * address and the kernel balances accepts between them.
+ */
+int Reactor::open_listener(int id, int port) {
+  int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (listen_fd == -1) {
+    spdlog::error("reactor {0}: could not create server socket.", id);
+    exit(1);
+  }
+
+  int enable = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                 sizeof(enable)) == -1) {
+    spdlog::error("reactor {0}: SO_REUSEPORT is not supported", id);
+    close(listen_fd);
+    exit(1);
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    spdlog::error("unable to bind server to given address: {0}", port);
+    close(listen_fd);
+    exit(2);
+  }
+
+  if (::listen(listen_fd, SOMAXCONN) == -1) {
+    spdlog::error("socket failed to listen on bound address");
+    close(listen_fd);
+    exit(3);
+  }
+  return listen_fd;
+}
+
+Reactor::~Reactor() { close(this->listen_fd_); }
+
+void Reactor::start() {
+  this->thread_ = std::thread([this]() { this->run(); });
+}
+
+void Reactor::join() {
+  if (this->thread_.joinable()) {
+    this->thread_.join();
+  }
+}
+
+/* Registers a freshly accepted connection.
+ * Returns nullptr (and closes the fd) when the server is full.
+ */
+std::shared_ptr<Client> Reactor::admit(int fd) {
+  auto reject = [fd]() -> std::shared_ptr<Client> {
+    spdlog::warn("server capacity is full.");
+    Metrics::count(COUNTER::REJECTED);
+    auto res = response(-1, SVR_CONNECT, std::string_view("server is full"));
+    send(fd, res.data->data(), res.data->size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+    return nullptr;
+  };
+
+  auto &clients = ClientManager::instance();
+  if (!clients.has_capacity())
+    return reject();
+  // the slab can still be out of ids (or lose a race for the last slot)
+  auto s_client = clients.add_client(fd);
+  if (s_client == nullptr)
+    return reject();
+
+  Metrics::count(COUNTER::ACCEPTED);
+  return s_client;
+}
+
+/* Posts every complete frame in the client's input buffer to its strand.
+ * Returns -1 on an invalid frame, a partial frame stays buffered.
+ */
+int Reactor::parse_incoming(const std::shared_ptr<Client> &s_client) {
+  while (true) {
+    std::vector<uint8_t> frame;
+    auto status = next_frame(s_client->input, frame,
+                             s_client->wire.load(std::memory_order_acquire));
+    if (status == FRAMESTATUS::PARTIAL)
+      return 0;
+    if (status == FRAMESTATUS::INVALID) {
+      spdlog::warn("invalid frame from {0}", s_client->username);
+      return -1;
+    }
+
+    s_client->strand->post([s_client, frame = std::move(frame),
+                            parsed = Metrics::now()]() mutable {
+      Request request(frame);
+      Response response = Protocol::handle_request(s_client, request);
+      Metrics::record(STAGE::HANDLE, parsed);
+      if (response.size > 0) {
+        s_client->send_packet(std::move(response));
+      }
+    });
+  }
+}
+
+/* Lets the client's strand tear the session down once the requests already
+ * posted have run.
+ */
+void Reactor::release(const std::shared_ptr<Client> &client) {
+  client->strand->post([client]() { Protocol::server_disconnect(client); });
+}
+
+EpollReactor::EpollReactor(int id, int port) : Reactor(id, port) {
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = this->listen_fd_;
+  this->epoll_fd_ = epoll_create1(0);
+  epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, this->listen_fd_, &ev);
+}
+
+EpollReactor::~EpollReactor() { close(this->epoll_fd_); }
+
+// * Waits on this reactor's own epoll instance.
+//
+// * Accepts connections from its own listening socket, reads readable
+// clients and drains outbound queues on EPOLLOUT.
+//
+// * Requests are handled on the client's strand, never on this thread.
+void EpollReactor::run() {
+  spdlog::debug("reactor {0} is now listening (epoll)", this->id_);
+  epoll_event events[50];
+  while (true) {
+    int nfds = epoll_wait(this->epoll_fd_, events, 50, -1);
+    int64_t woke = Metrics::now();
+    for (int i = 0; i < nfds; i++) {
+      int fd = events[i].data.fd;
+      if (fd == this->listen_fd_) {
+        this->accept_connections();
+        continue;
+      }
+
+      if (static_cast<size_t>(fd) >= this->clients_.size() ||
+          this->clients_[fd] == nullptr)
+        continue;
+
+      const auto &client = this->clients_[fd];
+      if (events[i].events & EPOLLOUT) {
+        client->flush();
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        Metrics::record(STAGE::WAKEUP, woke);
+        if (this->read_incoming(client) == -1) {
+          this->disconnect(fd);
+        }
+      }
+    }
+  }
+}
+
+/* Accepts every pending connection on the non-blocking listening socket.
+ * The accepted fd is registered on this reactor and never migrates.
+ */
+void EpollReactor::accept_connections() {
+  while (true) {
+    int ncfd = accept4(this->listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+    if (ncfd == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        spdlog::warn("reactor {0}: accept failed: {1}", this->id_, errno);
+      }
+      return;
+    }
+
+    auto client = this->admit(ncfd);
+    if (client == nullptr)
+      continue;
+    if (static_cast<size_t>(ncfd) >= this->clients_.size())
+      this->clients_.resize(ncfd + 1);
+    this->clients_[ncfd] = std::move(client);
+
+    epoll_event event{};
+    event.data.fd = ncfd;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, ncfd, &event);
+  }
+}
+
+void EpollReactor::disconnect(int fd) {
+  auto client = std::move(this->clients_[fd]);
+  epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  this->release(client);
+}
+
+/* Reads everything the socket has and posts every complete frame to the
+ * client's strand. Runs on the reactor thread, the socket is non-blocking.
+ *
+ * Returns -1 when the peer closed, the read failed or a frame was invalid.
+ * A partial frame stays in the client's input buffer until the next edge.
+ */
+int EpollReactor::read_incoming(const std::shared_ptr<Client> &s_client) {
+  auto &input = s_client->input;
+  while (true) {
+    auto regions = input.writable();
+    iovec iov[2] = {{regions[0].data(), regions[0].size()},
+                    {regions[1].data(), regions[1].size()}};
+
+    ssize_t n = readv(s_client->fd, iov, regions[1].empty() ? 1 : 2);
+    if (n == 0)
+      return -1;
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return -1;
+    }
+
+    input.commit(n);
+    if (this->parse_incoming(s_client) == -1)
+      return -1;
+  }
+}
@@ -0,0 +1,257 @@
+#include "snapshot.hh"
+#include "configurations.hh"
+#include "managers.hh"
+#include "message_log.hh"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t RECORD_SIZE = 15;
+
+uint64_t fnv1a(std::span<const char> bytes) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char byte : bytes) {
+    hash ^= static_cast<uint8_t>(byte);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+template <typename T> void put(std::vector<char> &out, const T &value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads fixed size fields off the front of a buffer, failing past its end.
+struct Reader {
+  std::span<const char> bytes;
+
+  template <typename T> bool get(T &value) {
+    if (this->bytes.size() < sizeof(T))
+      return false;
+    std::memcpy(&value, this->bytes.data(), sizeof(T));
+    this->bytes = this->bytes.subspan(sizeof(T));
+    return true;
+  }
+
+  bool get(std::string &value, size_t size) {
+    if (this->bytes.size() < size)
+      return false;
+    value.assign(this->bytes.data(), size);
+    this->bytes = this->bytes.subspan(size);
+    return true;
+  }
+};
+
+bool write_all(int fd, std::span<const char> bytes) {
+  while (!bytes.empty()) {
+    ssize_t written = ::write(fd, bytes.data(), bytes.size());
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    bytes = bytes.subspan(written);
+  }
+  return true;
+}
+
+} // namespace
+
+std::vector<char> Snapshot::encode(std::span<const ChannelRecord> records) {
+  size_t size = HEADER_SIZE + sizeof(uint64_t);
+  for (const auto &record : records)
+    size += RECORD_SIZE + record.name.size() + record.pinned.size();
+
+  std::vector<char> out;
+  out.reserve(size);
+  put(out, MAGIC);
+  put(out, VERSION);
+  put(out, static_cast<uint32_t>(records.size()));
+  for (const auto &record : records) {
+    auto name = std::string_view(record.name).substr(0, UINT16_MAX);
+    put(out, record.id);
+    put(out, static_cast<uint8_t>(record.secret));
+    put(out, record.next_seq);
+    put(out, static_cast<uint16_t>(name.size()));
+    put(out, static_cast<uint32_t>(record.pinned.size()));
+    out.insert(out.end(), name.begin(), name.end());
+    out.insert(out.end(), record.pinned.begin(), record.pinned.end());
+  }
+  put(out, fnv1a(out));
+  return out;
+}
+
+std::optional<std::vector<ChannelRecord>>
+Snapshot::decode(std::span<const char> bytes) {
+  if (bytes.size() < HEADER_SIZE + sizeof(uint64_t))
+    return std::nullopt;
+
+  uint64_t checksum;
+  auto body = bytes.first(bytes.size() - sizeof(checksum));
+  std::memcpy(&checksum, body.data() + body.size(), sizeof(checksum));
+  if (checksum != fnv1a(body))
+    return std::nullopt;
+
+  Reader reader{body};
+  uint32_t magic, version, count;
+  reader.get(magic);
+  reader.get(version);
+  reader.get(count);
+  // every record takes at least RECORD_SIZE bytes
+  if (magic != MAGIC || version != VERSION ||
+      count > reader.bytes.size() / RECORD_SIZE)
+    return std::nullopt;
+
+  std::vector<ChannelRecord> records(count);
+  for (auto &record : records) {
+    uint8_t secret;
+    uint16_t name_size;
+    uint32_t pinned_size;
+    if (!reader.get(record.id) || !reader.get(secret) ||
+        !reader.get(record.next_seq) || !reader.get(name_size) ||
+        !reader.get(pinned_size) || !reader.get(record.name, name_size) ||
+        !reader.get(record.pinned, pinned_size))
+      return std::nullopt;
+    record.secret = secret != 0;
+  }
+  if (!reader.bytes.empty())
+    return std::nullopt;
+  return records;
+}
+
+bool Snapshot::write(const std::filesystem::path &file,
+                     std::span<const char> bytes) {
+  auto temporary = file;
+  temporary += ".tmp";
+
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0644);
+  if (fd == -1)
+    return false;
+  bool written = write_all(fd, bytes) && fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(temporary.c_str(), file.c_str()) != 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+
+  // the rename itself has to reach the disk
+  int dir =
+      open(file.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir != -1) {
+    fsync(dir);
+    close(dir);
+  }
+  return true;
+}
+
+std::optional<std::vector<ChannelRecord>>
+Snapshot::read(const std::filesystem::path &file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return std::nullopt;
+
+  struct stat stat {};
+  fstat(fd, &stat);
+  std::vector<char> bytes(stat.st_size);
+  size_t got = 0;
+  while (got < bytes.size()) {
+    ssize_t n = ::read(fd, bytes.data() + got, bytes.size() - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  close(fd);
+  if (got != bytes.size())
+    return std::nullopt;
+  return decode(bytes);
+}
+
+Snapshot::Snapshot(std::filesystem::path dir, std::chrono::seconds interval)
+    : file_(dir / FILE_NAME), interval_(interval) {
+  std::filesystem::create_directories(dir);
+  if (this->interval_.count() <= 0)
+    return;
+
+  this->thread_ = std::thread([this]() {
+    std::unique_lock lock(this->stop_mtx_);
+    while (!this->stop_cv_.wait_for(lock, this->interval_,
+                                    [this]() { return this->stop_; })) {
+      lock.unlock();
+      this->save();
+      lock.lock();
+    }
+  });
+}
+
+Snapshot::~Snapshot() {
+  {
+    std::unique_lock lock(this->stop_mtx_);
+    this->stop_ = true;
+  }
+  this->stop_cv_.notify_one();
+  if (this->thread_.joinable())
+    this->thread_.join();
+}
+
+size_t Snapshot::load() {
+  if (!std::filesystem::exists(this->file_))
+    return 0;
+
+  auto records = read(this->file_);
+  if (!records) {
+    spdlog::error("snapshot {} is unreadable, starting without channels",
+                  this->file_.string());
+    return 0;
+  }
+
+  // messages logged after the snapshot was taken already used their ids
+  if (auto *log = MessageLog::instance()) {
+    for (auto &record : *records) {
+      int32_t logged = static_cast<int32_t>(log->last_id(record.id));
+      record.next_seq = std::max(record.next_seq, logged + 1);
+    }
+  }
+
+  std::unique_lock lock(this->save_mtx_);
+  this->last_ = encode(*records);
+  return ChannelManager::instance().restore(*records);
+}
+
+bool Snapshot::save() {
+  auto bytes = encode(ChannelManager::instance().records());
+
+  std::unique_lock lock(this->save_mtx_);
+  if (bytes == this->last_)
+    return true;
+  if (!write(this->file_, bytes)) {
+    spdlog::error("could not write snapshot {}: {}", this->file_.string(),
+                  std::strerror(errno));
+    return false;
+  }
+  spdlog::debug("snapshot written, {} bytes", bytes.size());
+  this->last_ = std::move(bytes);
+  return true;
+}
+
+Snapshot *Snapshot::instance() {
+  static std::unique_ptr<Snapshot> snapshot = []() {
+    auto &config = ServerConfiguration::instance();
+    return config.data_dir().empty()
+               ? nullptr
+               : std::make_unique<Snapshot>(
+                     config.data_dir(),
+                     std::chrono::seconds(config.snapshot_interval()));
+  }();
+  return snapshot.get();
+}
@@ -0,0 +1,486 @@
+#include "uring_reactor.hh"
+#include "client.hh"
+#include "metrics.hh"
+#include "spdlog/spdlog.h"
+#include "utilities.hh"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// user_data layout: operation in the high 32 bits, fd in the low 32 bits
+inline uint64_t user_data(uint8_t op, int fd) {
+  return static_cast<uint64_t>(op) << 32 | static_cast<uint32_t>(fd);
+}
+
+template <typename T> inline T load_acquire(T *ptr) {
+  return std::atomic_ref<T>(*ptr).load(std::memory_order_acquire);
+}
+
+template <typename T> inline void store_release(T *ptr, T value) {
+  std::atomic_ref<T>(*ptr).store(value, std::memory_order_release);
+}
+
+} // namespace
+
+std::unique_ptr<UringReactor> UringReactor::create(int id, int port) {
+  std::unique_ptr<UringReactor> reactor(new UringReactor(id, port));
+  if (!reactor->setup()) {
+    return nullptr;
+  }
+  return reactor;
+}
+
+/* Maps the rings, checks the kernel supports the operations we rely on
+ * (SEND_ZC implies multishot recv and provided buffer rings) and registers
+ * the provided buffers.
+ */
+bool UringReactor::setup() {
+  io_uring_params params{};
+  params.flags = IORING_SETUP_COOP_TASKRUN;
+  this->ring_fd_ = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (this->ring_fd_ < 0) {
+    params = {};
+    this->ring_fd_ = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  }
+  if (this->ring_fd_ < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    return false;
+  }
+
+  std::vector<uint8_t> probe_bytes(sizeof(io_uring_probe) +
+                                   256 * sizeof(io_uring_probe_op));
+  auto *probe = reinterpret_cast<io_uring_probe *>(probe_bytes.data());
+  if (syscall(__NR_io_uring_register, this->ring_fd_, IORING_REGISTER_PROBE,
+              probe, 256) < 0 ||
+      probe->last_op < IORING_OP_SEND_ZC ||
+      !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED)) {
+    return false;
+  }
+
+  this->sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  this->cq_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  size_t ring_size = std::max(this->sq_size_, this->cq_size_);
+  this->sq_size_ = ring_size;
+  this->sq_ptr_ = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, this->ring_fd_,
+                       IORING_OFF_SQ_RING);
+  if (this->sq_ptr_ == MAP_FAILED) {
+    this->sq_ptr_ = nullptr;
+    return false;
+  }
+  this->cq_ptr_ = this->sq_ptr_;
+
+  auto *sq = static_cast<uint8_t *>(this->sq_ptr_);
+  this->sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  this->sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  this->sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  this->sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  this->cq_head_ = reinterpret_cast<unsigned *>(sq + params.cq_off.head);
+  this->cq_tail_ = reinterpret_cast<unsigned *>(sq + params.cq_off.tail);
+  this->cq_mask_ = reinterpret_cast<unsigned *>(sq + params.cq_off.ring_mask);
+  this->cqes_ = reinterpret_cast<io_uring_cqe *>(sq + params.cq_off.cqes);
+  this->sq_entries_ = params.sq_entries;
+  this->sqe_tail_ = *this->sq_tail_;
+
+  void *sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    this->ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  this->sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  void *ring = mmap(nullptr, BUFFER_COUNT * sizeof(io_uring_buf),
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    return false;
+  }
+  this->buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = BUFFER_COUNT;
+  reg.bgid = BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, this->ring_fd_,
+              IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return false;
+  }
+
+  this->buffers_.resize(BUFFER_COUNT * BUFFER_SIZE);
+  for (uint16_t bid = 0; bid < BUFFER_COUNT; bid++) {
+    this->recycle_buffer(bid);
+  }
+
+  this->wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  return this->wake_fd_ != -1;
+}
+
+UringReactor::~UringReactor() {
+  this->connections_.clear();
+  if (this->ring_fd_ >= 0)
+    close(this->ring_fd_);
+  if (this->wake_fd_ >= 0)
+    close(this->wake_fd_);
+  if (this->sqes_ != nullptr)
+    munmap(this->sqes_, this->sq_entries_ * sizeof(io_uring_sqe));
+  if (this->sq_ptr_ != nullptr)
+    munmap(this->sq_ptr_, this->sq_size_);
+  if (this->buf_ring_ != nullptr)
+    munmap(this->buf_ring_, BUFFER_COUNT * sizeof(io_uring_buf));
+}
+
+/* Returns a zeroed SQE, submitting what is queued first if the ring is full.
+ * The tail is only published to the kernel in `submit`.
+ *
+ * Free slots are counted from the kernel's head: a slot is only reused once
+ * the kernel consumed the SQE in it, even after a partial or failed submit.
+ */
+io_uring_sqe *UringReactor::next_sqe() {
+  if (this->sqe_tail_ - load_acquire(this->sq_head_) >= this->sq_entries_) {
+    this->submit(0);
+    // still full, the kernel is short of room for completions: wait for one
+    while (this->sqe_tail_ - load_acquire(this->sq_head_) >=
+           this->sq_entries_) {
+      if (this->submit(1) < 0 && errno != EINTR && errno != EAGAIN &&
+          errno != EBUSY)
+        break;
+    }
+  }
+
+  unsigned index = this->sqe_tail_ & *this->sq_mask_;
+  io_uring_sqe *sqe = &this->sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  this->sq_array_[index] = index;
+  this->sqe_tail_++;
+  return sqe;
+}
+
+/* Publishes the filled SQEs and enters the ring. The count covers every SQE
+ * the kernel hasn't consumed yet, including those a previous partial submit
+ * left behind.
+ */
+int UringReactor::submit(unsigned wait) {
+  store_release(this->sq_tail_, this->sqe_tail_);
+  unsigned pending = this->sqe_tail_ - load_acquire(this->sq_head_);
+  return syscall(__NR_io_uring_enter, this->ring_fd_, pending, wait,
+                 wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+}
+
+/* Hands a provided buffer back to the kernel. Only the addr/len/bid fields
+ * are written, the ring tail is overlaid on the first entry's resv field.
+ *
+ * Entries are addressed from the ring base rather than through `bufs`: in
+ * C++ the empty struct __DECLARE_FLEX_ARRAY puts in front of it moves the
+ * array 8 bytes in.
+ */
+void UringReactor::recycle_buffer(uint16_t bid) {
+  auto *bufs = reinterpret_cast<io_uring_buf *>(this->buf_ring_);
+  auto &buf = bufs[this->buf_tail_ & (BUFFER_COUNT - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(this->buffers_.data() +
+                                        bid * static_cast<size_t>(BUFFER_SIZE));
+  buf.len = BUFFER_SIZE;
+  buf.bid = bid;
+  this->buf_tail_++;
+  store_release(&this->buf_ring_->tail, this->buf_tail_);
+}
+
+void UringReactor::arm_accept() {
+  auto *sqe = this->next_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = this->listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = user_data(static_cast<uint8_t>(OP::ACCEPT), -1);
+}
+
+void UringReactor::arm_wake() {
+  auto *sqe = this->next_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = this->wake_fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&this->wake_value_);
+  sqe->len = sizeof(this->wake_value_);
+  sqe->user_data = user_data(static_cast<uint8_t>(OP::WAKE), -1);
+}
+
+void UringReactor::arm_recv(int fd) {
+  auto *sqe = this->next_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = user_data(static_cast<uint8_t>(OP::RECV), fd);
+  this->connections_[fd]->inflight++;
+}
+
+/* Takes up to SEND_BATCH queued frames from the client and sends them, one
+ * send in flight per connection keeps the frames in order.
+ */
+void UringReactor::start_send(Connection &conn) {
+  if (conn.sending || conn.closing)
+    return;
+
+  auto &client = *conn.client;
+  {
+    std::unique_lock lock(client.out_mtx);
+    client.flush_pending = false;
+    while (!client.outbound.empty() && conn.frames.size() < SEND_BATCH) {
+      conn.frames.push_back(std::move(client.outbound.front()));
+      client.outbound.pop_front();
+    }
+    client.out_depth.store(client.outbound.size());
+  }
+
+  if (conn.frames.empty())
+    return;
+
+  conn.sending = true;
+  conn.sent_offset = 0;
+  this->submit_frames(conn);
+}
+
+/* A single large frame goes out zero-copy, anything else is coalesced into
+ * one sendmsg.
+ */
+void UringReactor::submit_frames(Connection &conn) {
+  int fd = conn.client->fd;
+  auto *sqe = this->next_sqe();
+  sqe->fd = fd;
+  sqe->msg_flags = MSG_NOSIGNAL;
+
+  auto &first = conn.frames.front();
+  if (conn.frames.size() == 1 &&
+      first->size() - conn.sent_offset >= SEND_ZC_THRESHOLD) {
+    sqe->opcode = IORING_OP_SEND_ZC;
+    sqe->addr = reinterpret_cast<uint64_t>(first->data() + conn.sent_offset);
+    sqe->len = first->size() - conn.sent_offset;
+    sqe->user_data = user_data(static_cast<uint8_t>(OP::SEND_ZC), fd);
+  } else {
+    size_t count = 0;
+    for (auto &frame : conn.frames) {
+      size_t skip = count == 0 ? conn.sent_offset : 0;
+      conn.iov[count].iov_base = const_cast<char *>(frame->data()) + skip;
+      conn.iov[count].iov_len = frame->size() - skip;
+      count++;
+    }
+    conn.msg = {};
+    conn.msg.msg_iov = conn.iov;
+    conn.msg.msg_iovlen = count;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+    sqe->len = 1;
+    sqe->user_data = user_data(static_cast<uint8_t>(OP::SEND), fd);
+  }
+  conn.inflight++;
+}
+
+/* Shuts the socket down so every pending operation completes, the
+ * connection is dropped once the last one has.
+ */
+void UringReactor::close_connection(Connection &conn) {
+  if (conn.closing)
+    return;
+
+  conn.closing = true;
+  conn.frames.clear();
+  shutdown(conn.client->fd, SHUT_RDWR);
+  this->release(conn.client);
+}
+
+void UringReactor::on_accept(const io_uring_cqe &cqe) {
+  if (cqe.res >= 0) {
+    int fd = cqe.res;
+    if (auto client = this->admit(fd)) {
+      client->uring = this;
+      auto conn = std::make_unique<Connection>();
+      conn->client = std::move(client);
+      this->connections_[fd] = std::move(conn);
+      this->arm_recv(fd);
+    }
+  } else {
+    spdlog::warn("reactor {0}: accept failed: {1}", this->id_, -cqe.res);
+  }
+
+  if (!(cqe.flags & IORING_CQE_F_MORE)) {
+    this->arm_accept();
+  }
+}
+
+void UringReactor::on_recv(Connection &conn, const io_uring_cqe &cqe) {
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    auto bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe.res > 0 && !conn.closing) {
+      auto &input = conn.client->input;
+      size_t n = cqe.res;
+      input.reserve(input.size() + n);
+
+      auto *data =
+          this->buffers_.data() + bid * static_cast<size_t>(BUFFER_SIZE);
+      auto regions = input.writable();
+      size_t first = std::min(n, regions[0].size());
+      std::memcpy(regions[0].data(), data, first);
+      std::memcpy(regions[1].data(), data + first, n - first);
+      input.commit(n);
+
+      if (this->parse_incoming(conn.client) == -1) {
+        this->close_connection(conn);
+      }
+    }
+    this->recycle_buffer(bid);
+  }
+
+  bool more = cqe.flags & IORING_CQE_F_MORE;
+  if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS)) {
+    this->close_connection(conn);
+  } else if (!more && !conn.closing) {
+    // multishot recv ended (buffers ran out), start a new one
+    this->arm_recv(conn.client->fd);
+  }
+}
+
+void UringReactor::on_send(Connection &conn, const io_uring_cqe &cqe,
+                           bool zero_copy) {
+  if (cqe.flags & IORING_CQE_F_NOTIF) {
+    conn.zc_hold.pop_front();
+    return;
+  }
+
+  // the kernel still references the buffer until the notification arrives
+  if (zero_copy && (cqe.flags & IORING_CQE_F_MORE)) {
+    conn.zc_hold.push_back(conn.frames.front());
+  }
+
+  if (conn.closing)
+    return;
+
+  if (cqe.res < 0) {
+    if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+      this->submit_frames(conn);
+    } else {
+      Metrics::count(COUNTER::SEND_FAILURES);
+      conn.sending = false;
+      this->close_connection(conn);
+    }
+    return;
+  }
+
+  size_t written = cqe.res + conn.sent_offset;
+  size_t done = 0;
+  while (done < conn.frames.size() && written >= conn.frames[done]->size()) {
+    written -= conn.frames[done]->size();
+    done++;
+  }
+  conn.frames.erase(conn.frames.begin(), conn.frames.begin() + done);
+  conn.sent_offset = written;
+
+  if (!conn.frames.empty()) {
+    this->submit_frames(conn);
+    return;
+  }
+
+  conn.sending = false;
+  this->start_send(conn);
+}
+
+void UringReactor::on_wake() {
+  std::vector<int> requests;
+  {
+    std::unique_lock lock(this->flush_mtx_);
+    requests.swap(this->flush_requests_);
+  }
+
+  for (int fd : requests) {
+    auto find = this->connections_.find(fd);
+    if (find != this->connections_.end()) {
+      this->start_send(*find->second);
+    }
+  }
+  this->arm_wake();
+}
+
+/* Called by strands after queueing frames on an io_uring client, the
+ * eventfd is only written when the request list goes from empty to not.
+ */
+void UringReactor::request_flush(int fd) {
+  bool wake;
+  {
+    std::unique_lock lock(this->flush_mtx_);
+    wake = this->flush_requests_.empty();
+    this->flush_requests_.push_back(fd);
+  }
+
+  if (wake) {
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(this->wake_fd_, &one, sizeof(one));
+  }
+}
+
+// * Submits everything queued and waits for at least one completion with a
+// single io_uring_enter.
+//
+// * Completions are consumed one by one, the CQ head is released before
+// handling so handlers can queue new submissions freely.
+void UringReactor::run() {
+  spdlog::debug("reactor {0} is now listening (io_uring)", this->id_);
+  this->arm_accept();
+  this->arm_wake();
+
+  while (true) {
+    if (this->submit(1) < 0 && errno != EINTR && errno != EBUSY) {
+      spdlog::error("reactor {0}: io_uring_enter failed: {1}", this->id_,
+                    errno);
+      return;
+    }
+
+    int64_t woke = Metrics::now();
+    unsigned head = *this->cq_head_;
+    unsigned tail = load_acquire(this->cq_tail_);
+    for (; head != tail; head++) {
+      io_uring_cqe cqe = this->cqes_[head & *this->cq_mask_];
+      store_release(this->cq_head_, head + 1);
+
+      auto op = static_cast<OP>(cqe.user_data >> 32);
+      int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+      if (op == OP::ACCEPT) {
+        this->on_accept(cqe);
+        continue;
+      }
+      if (op == OP::WAKE) {
+        this->on_wake();
+        continue;
+      }
+
+      auto find = this->connections_.find(fd);
+      if (find == this->connections_.end())
+        continue;
+
+      auto &conn = *find->second;
+      if (op == OP::RECV) {
+        Metrics::record(STAGE::WAKEUP, woke);
+        this->on_recv(conn, cqe);
+      } else {
+        this->on_send(conn, cqe, op == OP::SEND_ZC);
+      }
+
+      if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        conn.inflight--;
+      }
+      if (conn.closing && conn.inflight == 0) {
+        this->connections_.erase(find);
+      }
+    }
+  }
+}
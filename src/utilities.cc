@@ -1,8 +1,288 @@
 #include "utilities.hh"
 #include <cstdint>
 #include <cstring>
+#include <limits>
+#include <string>
 
-int i32_from_le(const std::vector<uint8_t> &bytes) {
-  return static_cast<int>(bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
-                          bytes[3] << 24);
+namespace {
+
+inline uint32_t u32_at(std::span<const uint8_t> bytes, size_t offset = 0) {
+  return static_cast<uint32_t>(i32_from_le(bytes.subspan(offset)));
+}
+
+template <typename T> inline void put(std::vector<uint8_t> &out, T value) {
+  auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+// Reads a varint that has to fit a u32.
+inline bool read_u32(std::span<const uint8_t> &bytes, uint32_t &value) {
+  uint64_t wide;
+  if (!read_varint(bytes, wide) ||
+      wide > std::numeric_limits<uint32_t>::max())
+    return false;
+  value = static_cast<uint32_t>(wide);
+  return true;
+}
+
+// Reads a zigzag delta and applies it to `value`, which has to stay a u32.
+inline bool read_delta(std::span<const uint8_t> &bytes, uint32_t &value) {
+  uint64_t delta;
+  if (!read_varint(bytes, delta))
+    return false;
+  int64_t next = static_cast<int64_t>(value) + unzigzag(delta);
+  if (next < 0 || next > std::numeric_limits<uint32_t>::max())
+    return false;
+  value = static_cast<uint32_t>(next);
+  return true;
+}
+
+inline void append_delta(std::string &out, uint32_t from, uint32_t to) {
+  append_varint(out, zigzag(static_cast<int64_t>(to) - from));
+}
+
+inline void append_text(std::string &out, std::span<const uint8_t> bytes) {
+  out.append(as_text(bytes));
+}
+
+/* v1 payload -> v2 payload, see WIRE. The message payloads are packed up
+ * to the first entry that doesn't have their layout, the server never
+ * sends one and rejects a request holding one either way.
+ */
+void encode_payload(std::string &out, uint32_t type,
+                    std::span<const uint8_t> payload, FROM from) {
+  if (type == (uint32_t)CH_MESSAGE && from == FROM::CLIENT &&
+      payload.size() >= 8) {
+    // channel | reply to | text
+    append_varint(out, u32_at(payload));
+    append_varint(out, u32_at(payload, 4));
+    append_text(out, payload.subspan(8));
+  } else if (type == (uint32_t)CH_MESSAGE && from == FROM::SERVER &&
+             payload.size() >= 12) {
+    // channel | sender | reply to | text
+    append_varint(out, u32_at(payload));
+    append_varint(out, u32_at(payload, 4));
+    append_varint(out, u32_at(payload, 8));
+    append_text(out, payload.subspan(12));
+  } else if (type == (uint32_t)CH_MESSAGE_BATCH && from == FROM::CLIENT) {
+    // Δchannel | reply to | length | text, per entry
+    uint32_t channel = 0;
+    while (payload.size() >= 10) {
+      uint32_t next = u32_at(payload);
+      uint16_t length = payload[8] | (payload[9] << 8);
+      if (payload.size() < 10u + length)
+        break;
+      append_delta(out, channel, next);
+      append_varint(out, u32_at(payload, 4));
+      append_varint(out, length);
+      append_text(out, payload.subspan(10, length));
+      channel = next;
+      payload = payload.subspan(10 + length);
+    }
+  } else if (type == (uint32_t)CH_MESSAGE_BUNDLE && from == FROM::SERVER) {
+    // length | Δid | Δchannel | Δsender | reply to | text, per message
+    uint32_t id = 0, channel = 0, sender = 0;
+    std::string entry;
+    while (payload.size() >= 4 + MIN_FRAME_SIZE + 12) {
+      uint32_t size = u32_at(payload);
+      if (size < MIN_FRAME_SIZE + 12 || payload.size() < 4 + size)
+        break;
+      auto inner = payload.subspan(4, size);
+      if (u32_at(inner, 4) != (uint32_t)CH_MESSAGE)
+        break;
+      uint32_t next_id = u32_at(inner);
+      uint32_t next_channel = u32_at(inner, 8);
+      uint32_t next_sender = u32_at(inner, 12);
+
+      entry.clear();
+      append_delta(entry, id, next_id);
+      append_delta(entry, channel, next_channel);
+      append_delta(entry, sender, next_sender);
+      append_varint(entry, u32_at(inner, 16));
+      append_text(entry, inner.subspan(20, size - 22));
+      append_varint(out, entry.size());
+      out.append(entry);
+
+      id = next_id;
+      channel = next_channel;
+      sender = next_sender;
+      payload = payload.subspan(4 + size);
+    }
+  } else {
+    append_text(out, payload);
+  }
+}
+
+/* v2 payload -> v1 payload, appended to `frame`.
+ */
+bool decode_payload(std::vector<uint8_t> &frame, uint32_t type,
+                    std::span<const uint8_t> payload, FROM from) {
+  auto append = [&frame](std::span<const uint8_t> bytes) {
+    frame.insert(frame.end(), bytes.begin(), bytes.end());
+  };
+
+  if (type == (uint32_t)CH_MESSAGE && !payload.empty()) {
+    uint32_t fields[3];
+    size_t count = from == FROM::CLIENT ? 2 : 3;
+    for (size_t i = 0; i < count; i++) {
+      if (!read_u32(payload, fields[i]))
+        return false;
+      put(frame, fields[i]);
+    }
+    append(payload);
+  } else if (type == (uint32_t)CH_MESSAGE_BATCH && from == FROM::CLIENT) {
+    uint32_t channel = 0;
+    while (!payload.empty()) {
+      uint32_t reply_to, length;
+      if (!read_delta(payload, channel) || !read_u32(payload, reply_to) ||
+          !read_u32(payload, length) || length > UINT16_MAX ||
+          length > payload.size())
+        return false;
+      put(frame, channel);
+      put(frame, reply_to);
+      put(frame, static_cast<uint16_t>(length));
+      append(payload.first(length));
+      payload = payload.subspan(length);
+    }
+  } else if (type == (uint32_t)CH_MESSAGE_BUNDLE && from == FROM::SERVER) {
+    uint32_t id = 0, channel = 0, sender = 0;
+    while (!payload.empty()) {
+      uint32_t length, reply_to;
+      if (!read_u32(payload, length) || length > payload.size())
+        return false;
+      auto entry = payload.first(length);
+      payload = payload.subspan(length);
+      if (!read_delta(entry, id) || !read_delta(entry, channel) ||
+          !read_delta(entry, sender) || !read_u32(entry, reply_to))
+        return false;
+
+      // the message as the whole v1 frame it was
+      put(frame, static_cast<uint32_t>(MIN_FRAME_SIZE + 12 + entry.size()));
+      put(frame, id);
+      put(frame, static_cast<uint32_t>(CH_MESSAGE));
+      put(frame, channel);
+      put(frame, sender);
+      put(frame, reply_to);
+      append(entry);
+      frame.push_back(0);
+      frame.push_back(0);
+    }
+  } else {
+    append(payload);
+  }
+  return true;
+}
+
+} // namespace
+
+shared_frame to_v2(const shared_frame &frame, FROM from) {
+  std::span<const uint8_t> bytes(
+      reinterpret_cast<const uint8_t *>(frame->data()), frame->size());
+  const uint32_t size = u32_at(bytes);
+  const int32_t id = i32_from_le(bytes.subspan(4));
+  const uint32_t type = u32_at(bytes, 8);
+
+  thread_local std::string body;
+  body.clear();
+  append_varint(body, zigzag(id));
+  body.push_back(static_cast<char>(type));
+  encode_payload(body, type, bytes.subspan(12, size - MIN_FRAME_SIZE), from);
+
+  std::string length;
+  append_varint(length, body.size());
+  auto encoded = FramePool::acquire(length.size() + body.size());
+  std::memcpy(encoded.get()->data(), length.data(), length.size());
+  std::memcpy(encoded.get()->data() + length.size(), body.data(), body.size());
+  return encoded;
+}
+
+bool decode_v2(std::span<const uint8_t> body, std::vector<uint8_t> &frame,
+               FROM from) {
+  uint64_t id;
+  if (!read_varint(body, id) || body.empty())
+    return false;
+  const uint32_t type = body[0];
+
+  frame.clear();
+  put(frame, static_cast<int32_t>(unzigzag(id)));
+  put(frame, type);
+  if (!decode_payload(frame, type, body.subspan(1), from))
+    return false;
+  frame.push_back(0);
+  frame.push_back(0);
+  return true;
+}
+
+uint32_t frame_type(const shared_frame &frame, WIRE wire) {
+  std::span<const uint8_t> bytes(
+      reinterpret_cast<const uint8_t *>(frame->data()), frame->size());
+  if (wire == WIRE::V1)
+    return u32_at(bytes, 8);
+
+  uint64_t skipped;
+  if (!read_varint(bytes, skipped) || !read_varint(bytes, skipped) ||
+      bytes.empty())
+    return 0;
+  return bytes[0];
+}
+
+/* Pulls the next complete frame out of a connection's input buffer.
+ *
+ * A v1 frame is a 4 byte little endian size followed by that many bytes. The
+ * size prefix is consumed together with the body, so on PARTIAL nothing is
+ * consumed and the caller simply waits for more bytes. The body is copied
+ * into `frame`, which callers keep around so its capacity is reused.
+ *
+ * A v2 frame is read the same way behind its varint length, and `frame`
+ * gets the body decoded to v1.
+ */
+FRAMESTATUS next_frame(RingBuffer &input, std::vector<uint8_t> &frame,
+                       WIRE wire) {
+  if (wire == WIRE::V2) {
+    // a length up to MAX_FRAME_SIZE takes at most 3 bytes
+    uint8_t header[3];
+    size_t peeked = std::min<size_t>(input.size(), sizeof(header));
+    input.peek(header, peeked);
+    std::span<const uint8_t> rest(header, peeked);
+    uint64_t length;
+    if (!read_varint(rest, length))
+      return peeked < sizeof(header) ? FRAMESTATUS::PARTIAL
+                                     : FRAMESTATUS::INVALID;
+    size_t prefix = peeked - rest.size();
+    if (length < 2 || length > MAX_FRAME_SIZE)
+      return FRAMESTATUS::INVALID;
+
+    if (input.size() < prefix + length) {
+      input.reserve(prefix + length);
+      return FRAMESTATUS::PARTIAL;
+    }
+
+    thread_local std::vector<uint8_t> body;
+    body.resize(length);
+    input.peek(body.data(), length, prefix);
+    input.consume(prefix + length);
+    return decode_v2(body, frame, FROM::CLIENT) ? FRAMESTATUS::READY
+                                                : FRAMESTATUS::INVALID;
+  }
+
+  if (input.size() < 4)
+    return FRAMESTATUS::PARTIAL;
+
+  uint8_t header[4];
+  input.peek(header, 4);
+  uint32_t size = static_cast<uint32_t>(header[0] | header[1] << 8 |
+                                        header[2] << 16 | header[3] << 24);
+  if (size < MIN_FRAME_SIZE || size > MAX_FRAME_SIZE)
+    return FRAMESTATUS::INVALID;
+
+  if (input.size() < size + 4) {
+    // let the buffer grow so the rest of the frame can land in one read
+    input.reserve(size + 4);
+    return FRAMESTATUS::PARTIAL;
+  }
+
+  frame.resize(size);
+  input.peek(frame.data(), size, 4);
+  input.consume(size + 4);
+  return FRAMESTATUS::READY;
 }
@@ -1,14 +1,16 @@
 #include "websocket_server.hh"
 #include "client.hh"
 #include "managers.hh"
+#include "metrics.hh"
 #include "protocol.hh"
-#include "thread_pool.hh"
 #include "typedef.hh"
 #include "utilities.hh"
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <span>
 #include <spdlog/spdlog.h>
+#include <vector>
 #include <websocketpp/common/connection_hdl.hpp>
 
 void WebSocketServer::run(uint16_t port) {
@@ -34,6 +36,9 @@ WebSocketServer::WebSocketServer(std::shared_ptr<Server> server)
   this->ws_server_.set_message_handler(
       std::bind(&WebSocketServer::on_message, this, _1, _2));
 
+  this->ws_server_.set_http_handler(
+      std::bind(&WebSocketServer::on_http, this, _1));
+
   this->ws_server_.init_asio();
   this->ws_server_.set_reuse_addr(true);
 }
@@ -41,44 +46,79 @@ WebSocketServer::WebSocketServer(std::shared_ptr<Server> server)
 void WebSocketServer::on_open(ws_handle hdl) {
   spdlog::info("on_open handler called!"); // Change to info temporarily
   auto &ctx = ClientManager::instance();
-  auto clientId = ctx.add_client(hdl);
-  this->handle_to_id_.emplace(hdl, clientId);
+  if (!ctx.has_capacity() ||
+      ctx.add_client(hdl, &this->ws_server_) == nullptr) {
+    spdlog::warn("server capacity is full.");
+    Metrics::count(COUNTER::REJECTED);
+    websocketpp::lib::error_code ec;
+    this->ws_server_.close(hdl, websocketpp::close::status::try_again_later,
+                           "server is full", ec);
+    return;
+  }
+  Metrics::count(COUNTER::ACCEPTED);
   spdlog::debug("new websocket client connected:");
 }
 
+/* Plain HTTP requests on the WebSocket port, GET /metrics returns the
+ * runtime metrics for a Prometheus style scraper.
+ */
+void WebSocketServer::on_http(ws_handle hdl) {
+  auto connection = this->ws_server_.get_con_from_hdl(hdl);
+  if (connection->get_resource() != "/metrics") {
+    connection->set_status(websocketpp::http::status_code::not_found);
+    return;
+  }
+
+  connection->set_status(websocketpp::http::status_code::ok);
+  connection->append_header("Content-Type", "text/plain; version=0.0.4");
+  connection->set_body(Metrics::render());
+}
+
 void WebSocketServer::on_close(ws_handle hdl) {
   auto &ctx = ClientManager::instance();
-  auto fclient = ctx.find_client(hdl);
-  if (fclient == std::nullopt)
+  auto s_client = ctx.find_client(hdl);
+  if (s_client == nullptr)
     return;
 
-  w_client s_client = fclient.value();
-  ThreadPool::initialize().enqueue(
+  s_client->strand->post(
       [s_client]() { Protocol::server_disconnect(s_client); });
 }
 
+/* Hands the request to the client's strand, so WebSocket requests are
+ * ordered the same way TCP ones are and never run on the asio thread.
+ */
 void WebSocketServer::on_message(ws_handle hdl, message_ptr msg) {
   auto &ctx = ClientManager::instance();
-  auto conn = this->ws_server_.get_con_from_hdl(hdl);
 
-  std::shared_ptr<Client> s_client;
-  {
-    auto fclient = ctx.find_client(hdl);
-    if (fclient == std::nullopt)
-      return;
-    s_client = fclient.value();
-  }
+  auto s_client = ctx.find_client(hdl);
+  if (s_client == nullptr)
+    return;
 
-  auto payload = msg->get_payload();
-  std::vector<uint8_t> buffer(payload.begin() + 4, payload.end());
-  Request request(buffer);
+  s_client->strand->post([s_client, msg, parsed = Metrics::now()]() {
+    // the message outlives the task, a v1 request views it in place
+    auto &payload = msg->get_payload();
+    std::span bytes(reinterpret_cast<const uint8_t *>(payload.data()),
+                    payload.size());
 
-  auto response = Protocol::handle_request(s_client, request);
+    // read here, SVR_CONNECT may have switched it since on_message ran
+    thread_local std::vector<uint8_t> decoded;
+    if (s_client->wire.load(std::memory_order_acquire) == WIRE::V2) {
+      uint64_t length;
+      if (!read_varint(bytes, length) || length != bytes.size() ||
+          !decode_v2(bytes, decoded, FROM::CLIENT))
+        return;
+      bytes = decoded;
+    } else if (bytes.size() < 4 + MIN_FRAME_SIZE) {
+      return;
+    } else {
+      bytes = bytes.subspan(4);
+    }
+    Request request(bytes);
 
-  try {
-    ws_server_.send(hdl, response.data.data(), response.data.size(),
-                    websocketpp::frame::opcode::binary);
-  } catch (const std::exception &e) {
-    spdlog::error("WebSocket send failed: {}", e.what());
-  }
+    auto response = Protocol::handle_request(s_client, request);
+    Metrics::record(STAGE::HANDLE, parsed);
+    if (response.size > 0 && !s_client->send_packet(std::move(response))) {
+      spdlog::error("WebSocket send failed: {}", s_client->username);
+    }
+  });
 }
@@ -0,0 +1,113 @@
+#include "channel_directory.hh"
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <gtest/gtest.h>
+#include <vector>
+
+struct Listed {
+  uint32_t id;
+  bool secret;
+  std::string name;
+};
+
+// Entries of an encoded page, checks the header on the way.
+static std::vector<Listed> entries(const shared_frame &frame, uint32_t page,
+                                   bool &last) {
+  const char *data = frame->data();
+  uint32_t index;
+  std::memcpy(&index, data + 16, 4);
+  EXPECT_EQ(index, page);
+  last = data[20] == 1;
+
+  std::vector<Listed> listed;
+  size_t end = frame->size() - 2;
+  for (size_t at = 21; at < end;) {
+    Listed entry;
+    uint16_t size;
+    std::memcpy(&entry.id, data + at, 4);
+    entry.secret = data[at + 4] == 1;
+    std::memcpy(&size, data + at + 5, 2);
+    entry.name.assign(data + at + 7, size);
+    listed.push_back(entry);
+    at += 7 + size;
+  }
+  return listed;
+}
+
+static std::vector<Listed> everything(ChannelDirectory &directory) {
+  std::vector<Listed> listed;
+  bool last = false;
+  for (uint32_t page = 0; !last; page++) {
+    auto encoded = directory.page(page);
+    EXPECT_TRUE(encoded.frame.has_value());
+    if (!encoded.frame)
+      break;
+    auto more = entries(*encoded.frame, page, last);
+    listed.insert(listed.end(), more.begin(), more.end());
+  }
+  return listed;
+}
+
+TEST(CHANNEL_DIRECTORY, LISTS_EVERY_CHANNEL_ONCE_IN_ORDER) {
+  ChannelDirectory directory;
+  EXPECT_TRUE(everything(directory).empty());
+
+  for (uint32_t id = 1; id <= 3000; id++)
+    directory.upsert(id, id % 3 == 0, std::format("channel-{:012}", id));
+  for (uint32_t id = 100; id <= 3000; id += 100)
+    directory.erase(id);
+
+  auto listed = everything(directory);
+  ASSERT_EQ(listed.size(), 2970u);
+  EXPECT_GT(directory.page(0).frame.value()->size(),
+            ChannelDirectory::PAGE_BYTES / 2);
+  EXPECT_FALSE(directory.page(100).frame.has_value());
+  for (size_t i = 1; i < listed.size(); i++)
+    ASSERT_LT(listed[i - 1].id, listed[i].id);
+  EXPECT_EQ(listed[2].id, 3u);
+  EXPECT_TRUE(listed[2].secret);
+  EXPECT_EQ(listed[2].name, "channel-000000000003");
+}
+
+TEST(CHANNEL_DIRECTORY, ONLY_CHANGED_PAGES_ARE_RE_ENCODED) {
+  ChannelDirectory directory;
+  for (uint32_t id = 1; id <= 3000; id++)
+    directory.upsert(id, false, std::format("channel-{:012}", id));
+
+  auto first = directory.page(0);
+  auto second = directory.page(1);
+  ASSERT_TRUE(first.frame && second.frame);
+
+  // a privacy change only touches its own page
+  directory.set_secret(1, true);
+  auto changed = directory.page(0);
+  EXPECT_NE(changed.version, first.version);
+  EXPECT_EQ(directory.page(1).version, second.version);
+  EXPECT_EQ(directory.page(1).frame.value().get(), second.frame->get());
+
+  // a new channel lands at the end, the pages before the last stay shared
+  size_t pages = 0;
+  while (directory.page(pages).frame)
+    pages++;
+  ASSERT_GT(pages, 2u);
+  auto before_last = directory.page(pages - 2);
+  directory.upsert(5000, false, "newest");
+  EXPECT_EQ(directory.page(0).frame.value().get(), changed.frame->get());
+  auto unchanged = directory.page(pages - 2);
+  EXPECT_EQ(unchanged.version, before_last.version);
+  EXPECT_EQ(unchanged.frame.value().get(), before_last.frame->get());
+  EXPECT_EQ(everything(directory).back().name, "newest");
+
+  // emptying the last page makes the one before it the last
+  pages = 0;
+  while (directory.page(pages).frame)
+    pages++;
+  bool last = false;
+  for (const auto &entry :
+       entries(*directory.page(pages - 1).frame, pages - 1, last))
+    directory.erase(entry.id);
+  EXPECT_FALSE(directory.page(pages - 1).frame.has_value());
+  entries(*directory.page(pages - 2).frame, pages - 2, last);
+  EXPECT_TRUE(last);
+}
@@ -0,0 +1,21 @@
+#include "epoch.hh"
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(EPOCH, FREES_ONCE_THE_LAST_READER_LEAVES) {
+  std::atomic_bool freed{false};
+  {
+    Epoch::Guard guard;
+    Epoch::retire([&freed]() { freed = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(freed);
+  }
+
+  // nothing else retires, the reclaimer gets to it on its own
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!freed && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  EXPECT_TRUE(freed);
+}
@@ -0,0 +1,44 @@
+#include "frame_pool.hh"
+#include "utilities.hh"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+
+TEST(FRAME_POOL, RESPONSE_KEEPS_THE_WHOLE_PAYLOAD) {
+  auto packet = response(3, CH_MESSAGE, std::string_view("hello"));
+  ASSERT_EQ(packet.size, 15);
+  ASSERT_EQ(packet.data->size(), 19);
+
+  const char *bytes = packet.data->data();
+  EXPECT_EQ(std::string(bytes + 12, 5), "hello");
+  EXPECT_EQ(bytes[17], '\0');
+  EXPECT_EQ(bytes[18], '\0');
+}
+
+TEST(FRAME_POOL, RELEASED_BUFFERS_ARE_REUSED) {
+  const FrameBuffer *first;
+  {
+    auto frame = FramePool::acquire(14);
+    first = frame.get();
+  }
+
+  auto before = FramePool::stats().allocations;
+  for (int i = 0; i < 100; i++) {
+    auto frame = FramePool::acquire(14);
+    auto copy = frame;
+    EXPECT_EQ(copy.get(), first);
+  }
+  EXPECT_EQ(FramePool::stats().allocations, before);
+}
+
+TEST(FRAME_POOL, OVERSIZED_FRAMES_ARE_NOT_POOLED) {
+  auto before = FramePool::stats();
+  {
+    auto frame = FramePool::acquire(1 << 20);
+    EXPECT_EQ(frame->size(), 1u << 20);
+  }
+  auto after = FramePool::stats();
+  EXPECT_EQ(after.oversized, before.oversized + 1);
+  EXPECT_EQ(after.frees, before.frees + 1);
+}
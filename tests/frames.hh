@@ -0,0 +1,21 @@
+#pragma once
+
+#include "utilities.hh"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/* a CH_MESSAGE response carrying `length` bytes, tagged with `seq` as its id */
+inline shared_frame message(int32_t seq, size_t length) {
+  return share(response(seq, CH_MESSAGE, std::string(length, 'x')));
+}
+
+/* the ids of the given frames, in order */
+inline std::vector<int32_t> seqs(const std::vector<shared_frame> &frames) {
+  std::vector<int32_t> ids;
+  for (const auto &frame : frames)
+    ids.push_back(i32_from_le(std::span(
+        reinterpret_cast<const uint8_t *>(frame->data()) + 4, 4)));
+  return ids;
+}
@@ -0,0 +1,48 @@
+#include "configurations.hh"
+#include "frames.hh"
+#include "history.hh"
+#include "utilities.hh"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+TEST(HISTORY, KEEPS_THE_LAST_MESSAGES_IN_ORDER) {
+  History history(4);
+  for (int32_t seq = 1; seq <= 6; seq++)
+    history.record(message(seq, 8));
+
+  EXPECT_EQ(history.size(), 4u);
+  EXPECT_EQ(seqs(history.last(10)), (std::vector<int32_t>{3, 4, 5, 6}));
+  EXPECT_EQ(seqs(history.last(2)), (std::vector<int32_t>{5, 6}));
+  // a client that saw message 4 only gets what came after it
+  EXPECT_EQ(seqs(history.last(10, 4)), (std::vector<int32_t>{5, 6}));
+  EXPECT_TRUE(history.last(10, 6).empty());
+}
+
+TEST(HISTORY, STAYS_WITHIN_THE_GLOBAL_BUDGET) {
+  auto &config = ServerConfiguration::instance();
+  // one of these fits under the per channel floor, two don't
+  const size_t length = HISTORY_FLOOR_BYTES * 2 / 3;
+  size_t frame_size = message(0, length)->size();
+  config.set_history_bytes(History::total_bytes() + 3 * frame_size);
+
+  History first(8);
+  History second(8);
+  first.record(message(1, length));
+  first.record(message(2, length));
+  second.record(message(1, length));
+  // over the budget, the channel recording drops its own oldest message
+  second.record(message(2, length));
+  EXPECT_EQ(seqs(first.last(8)), (std::vector<int32_t>{1, 2}));
+  EXPECT_EQ(seqs(second.last(8)), (std::vector<int32_t>{2}));
+  EXPECT_EQ(first.bytes() + second.bytes(), 3 * frame_size);
+
+  // the budget is used up, a quiet channel still keeps its floor
+  History third(8);
+  third.record(message(1, length));
+  third.record(message(2, length));
+  EXPECT_EQ(seqs(third.last(8)), (std::vector<int32_t>{2}));
+
+  config.set_history_bytes(HISTORY_BYTES);
+}
@@ -0,0 +1,75 @@
+#include "client.hh"
+#include "managers.hh"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+static uint32_t create(const char *name) {
+  auto info = ChannelManager::instance().create_channel(name, false);
+  uint32_t id;
+  std::memcpy(&id, info.data(), 4);
+  return id;
+}
+
+TEST(CHANNEL_MANAGER, HANDLES_OUTLIVE_REMOVAL) {
+  auto &channels = ChannelManager::instance();
+  uint32_t id = create("removed");
+  auto handle = channels.find_channel(id);
+  ASSERT_NE(handle, nullptr);
+
+  channels.remove_channel(id);
+  EXPECT_EQ(channels.find_channel(id), nullptr);
+  EXPECT_EQ(handle->id, id);
+  EXPECT_EQ(handle->name, "removed");
+}
+
+TEST(CHANNEL_MANAGER, CONCURRENT_CREATES_GET_DISTINCT_IDS) {
+  std::vector<std::vector<uint32_t>> ids(4);
+  std::vector<std::thread> threads;
+  for (auto &out : ids) {
+    threads.emplace_back([&out]() {
+      for (int i = 0; i < 100; i++)
+        out.push_back(create("concurrent"));
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  std::vector<uint32_t> all;
+  for (auto &out : ids)
+    all.insert(all.end(), out.begin(), out.end());
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(std::adjacent_find(all.begin(), all.end()), all.end());
+  for (uint32_t id : all)
+    EXPECT_NE(ChannelManager::instance().find_channel(id), nullptr);
+}
+
+TEST(CLIENT_MANAGER, STALE_IDS_DONT_RESOLVE_AFTER_REUSE) {
+  auto &clients = ClientManager::instance();
+  int first_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  auto first = clients.add_client(first_fd);
+  ASSERT_NE(first, nullptr);
+  uint32_t stale = first->id;
+  EXPECT_EQ(clients.find_client(stale), first);
+  EXPECT_EQ(clients.find_by_fd(first_fd), first);
+
+  clients.remove_client(stale);
+  EXPECT_EQ(clients.find_client(stale), nullptr);
+  EXPECT_EQ(clients.find_by_fd(first_fd), nullptr);
+
+  // the freed slot is reused under a new generation
+  int second_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  auto second = clients.add_client(second_fd);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(second->id & ClientManager::SLOT_MASK,
+            stale & ClientManager::SLOT_MASK);
+  EXPECT_NE(second->id, stale);
+  EXPECT_EQ(clients.find_client(stale), nullptr);
+  EXPECT_EQ(clients.find_client(second->id), second);
+
+  clients.remove_client(second->id);
+}
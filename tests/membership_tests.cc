@@ -0,0 +1,108 @@
+#include "channel.hh"
+#include "channel_set.hh"
+#include "client.hh"
+#include "membership.hh"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+TEST(MEMBERSHIP, REMOVAL_KEEPS_THE_OTHERS_ADDRESSABLE) {
+  Membership members;
+  std::vector<std::shared_ptr<Client>> clients;
+  for (int id = 1; id <= 4; id++) {
+    clients.push_back(std::make_shared<Client>(-1, id));
+    ASSERT_TRUE(members.add(id, clients.back()));
+  }
+  EXPECT_FALSE(members.add(2, clients[1]));
+
+  // the last member moves into the first slot
+  members.set_moderator(4, true);
+  ASSERT_TRUE(members.remove(1));
+  EXPECT_FALSE(members.remove(1));
+  EXPECT_EQ(members.size(), 3u);
+  EXPECT_FALSE(members.contains(1));
+  EXPECT_TRUE(members.is_moderator(4));
+  EXPECT_FALSE(members.is_moderator(2));
+
+  for (uint32_t id : {2u, 3u, 4u}) {
+    auto handle = members.find(id);
+    ASSERT_TRUE(handle.has_value());
+    EXPECT_EQ(handle->lock()->id, static_cast<int>(id));
+  }
+  EXPECT_EQ(members.handles().size(), members.ids().size());
+}
+
+TEST(MEMBERSHIP, BROADCASTS_KEEP_THE_SNAPSHOT_THEY_LOADED) {
+  Channel channel(1, "snapshots");
+  auto first = std::make_shared<Client>(-1, 1);
+  auto second = std::make_shared<Client>(-1, 2);
+  ASSERT_EQ(channel.join_channel(first), JOINRESULT::SUCCESS);
+
+  auto loaded = channel.recipients.load();
+  ASSERT_EQ(channel.join_channel(second), JOINRESULT::SUCCESS);
+  channel.leave_channel(first);
+
+  ASSERT_EQ(loaded->size(), 1u);
+  EXPECT_EQ(loaded->front().lock(), first);
+  auto current = channel.recipients.load();
+  ASSERT_EQ(current->size(), 1u);
+  EXPECT_EQ(current->front().lock(), second);
+}
+
+TEST(MEMBERSHIP, BUNDLED_DRAINS_KEEP_MESSAGE_IDS_CONTIGUOUS) {
+  Channel channel(1, "bundles");
+  auto drain = [&channel](uint32_t count) {
+    // owned by the test instead of the broadcast scheduler
+    channel.scheduled = true;
+    for (uint32_t i = 0; i < count; i++)
+      channel.queue_message(MessageView(1, 1, 0, "hello"));
+    EXPECT_FALSE(channel.drain(64));
+  };
+  drain(4);
+  drain(1);
+  drain(3);
+
+  auto frames = channel.history.last(16);
+  ASSERT_EQ(frames.size(), 8u);
+  for (size_t i = 0; i < frames.size(); i++) {
+    int32_t id;
+    std::memcpy(&id, frames[i]->data() + 4, sizeof(id));
+    EXPECT_EQ(id, static_cast<int32_t>(i + 1));
+  }
+  EXPECT_EQ(channel.packetIds.load(), 9);
+}
+
+TEST(CHANNEL_SET, STAYS_EXACT_PAST_THE_FLAT_ARRAY) {
+  ChannelSet channels;
+  constexpr uint32_t JOINED = 4 * ChannelSet::FLAT_MAX;
+  for (uint32_t id = 1; id <= JOINED; id++) {
+    ASSERT_TRUE(channels.insert(id * 7));
+    EXPECT_TRUE(channels.contains(id * 7));
+  }
+  EXPECT_FALSE(channels.insert(7));
+  EXPECT_EQ(channels.size(), JOINED);
+
+  // leaves rebuild the hash table without the removed ids
+  for (uint32_t id = 1; id <= JOINED; id += 2)
+    ASSERT_TRUE(channels.erase(id * 7));
+  EXPECT_FALSE(channels.erase(7));
+  for (uint32_t id = 1; id <= JOINED; id++)
+    EXPECT_EQ(channels.contains(id * 7), id % 2 == 0) << id;
+  EXPECT_FALSE(channels.contains(3));
+
+  auto ids = channels.ids();
+  EXPECT_EQ(ids.size(), JOINED / 2);
+  EXPECT_TRUE(std::is_sorted(ids.begin(), ids.end()));
+}
+
+TEST(CHANNEL_SET, NEVER_HOLDS_THE_EMPTY_SLOT_ID) {
+  ChannelSet channels;
+  for (uint32_t id = 1; id <= 2 * ChannelSet::FLAT_MAX; id++) {
+    ASSERT_TRUE(channels.insert(id));
+    EXPECT_FALSE(channels.contains(0)) << id;
+  }
+  EXPECT_FALSE(channels.insert(0));
+  EXPECT_FALSE(channels.erase(0));
+  EXPECT_EQ(channels.size(), 2 * ChannelSet::FLAT_MAX);
+}
@@ -0,0 +1,130 @@
+#include "frames.hh"
+#include "message_log.hh"
+#include "utilities.hh"
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static constexpr size_t LENGTH = 1000;
+
+static std::vector<int32_t> range(int32_t first, int32_t last) {
+  std::vector<int32_t> ids;
+  for (int32_t id = first; id <= last; id++)
+    ids.push_back(id);
+  return ids;
+}
+
+class MESSAGE_LOG : public ::testing::Test {
+protected:
+  std::filesystem::path dir;
+
+  void SetUp() override {
+    std::string pattern =
+        (std::filesystem::temp_directory_path() / "relay-log-XXXXXX").string();
+    ASSERT_NE(mkdtemp(pattern.data()), nullptr);
+    this->dir = pattern;
+  }
+
+  void TearDown() override { std::filesystem::remove_all(this->dir); }
+
+  static size_t open_files() {
+    return std::distance(std::filesystem::directory_iterator("/proc/self/fd"),
+                         std::filesystem::directory_iterator());
+  }
+
+  size_t segments(uint32_t channel) {
+    size_t count = 0;
+    auto channel_dir = this->dir / std::to_string(channel);
+    for (const auto &file : std::filesystem::directory_iterator(channel_dir))
+      count += file.path().extension() == ".log";
+    return count;
+  }
+};
+
+TEST_F(MESSAGE_LOG, READS_BACK_ACROSS_SEGMENTS) {
+  // segments are at least one max sized frame, ~64 of these each
+  size_t files = open_files();
+  MessageLog log(this->dir, 0);
+  for (int32_t seq = 1; seq <= 200; seq++) {
+    ASSERT_TRUE(log.append(1, message(seq, LENGTH)));
+    ASSERT_TRUE(log.append(2, message(seq, 8)));
+  }
+  log.sync();
+
+  EXPECT_GT(this->segments(1), 2u);
+  // sealed segments are closed, only each channel's open one holds files
+  EXPECT_LE(open_files(), files + 4);
+  EXPECT_EQ(seqs(log.read(1, 0, 1000)), range(1, 200));
+  EXPECT_EQ(seqs(log.read(1, 60, 10)), range(61, 70));
+  EXPECT_EQ(seqs(log.read(2, 195, 10)), range(196, 200));
+  EXPECT_TRUE(log.read(1, 200, 10).empty());
+  EXPECT_TRUE(log.read(3, 0, 10).empty());
+  EXPECT_EQ(log.last_channel(), 2u);
+}
+
+TEST_F(MESSAGE_LOG, RECOVERS_AFTER_A_RESTART) {
+  {
+    MessageLog log(this->dir, 0);
+    for (int32_t seq = 1; seq <= 100; seq++)
+      log.append(7, message(seq, LENGTH));
+  }
+
+  MessageLog log(this->dir, 0);
+  EXPECT_EQ(seqs(log.read(7, 0, 1000)), range(1, 100));
+  EXPECT_EQ(log.last_channel(), 7u);
+
+  // appends go on in a new segment, older ids are refused
+  log.append(7, message(50, LENGTH));
+  log.append(7, message(101, LENGTH));
+  log.sync();
+  EXPECT_EQ(seqs(log.read(7, 98, 10)), range(99, 101));
+  EXPECT_EQ(log.stats().dropped, 1u);
+}
+
+TEST_F(MESSAGE_LOG, DROPS_A_TORN_TAIL_ON_RECOVERY) {
+  size_t frame_size = message(0, LENGTH)->size();
+  {
+    MessageLog log(this->dir, 0);
+    for (int32_t seq = 1; seq <= 10; seq++)
+      log.append(1, message(seq, LENGTH));
+  }
+
+  // the index made it to disk but the last frame's page didn't
+  auto data = this->dir / "1" / "0000000001.log";
+  {
+    std::fstream file(data, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(9 * frame_size + 4);
+    const char zeros[4] = {};
+    file.write(zeros, sizeof(zeros));
+  }
+
+  MessageLog log(this->dir, 0);
+  EXPECT_EQ(seqs(log.read(1, 0, 100)), range(1, 9));
+  EXPECT_EQ(std::filesystem::file_size(data), 9 * frame_size);
+}
+
+TEST_F(MESSAGE_LOG, DROPS_A_FRAME_WITH_A_TORN_PAYLOAD) {
+  size_t frame_size = message(0, LENGTH)->size();
+  {
+    MessageLog log(this->dir, 0);
+    for (int32_t seq = 1; seq <= 10; seq++)
+      log.append(1, message(seq, LENGTH));
+  }
+
+  // the last frame's header page made it to disk but not its tail
+  auto data = this->dir / "1" / "0000000001.log";
+  {
+    std::fstream file(data, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(10 * frame_size - 100);
+    file.put('y');
+  }
+
+  MessageLog log(this->dir, 0);
+  EXPECT_EQ(seqs(log.read(1, 0, 100)), range(1, 9));
+  EXPECT_EQ(std::filesystem::file_size(data), 9 * frame_size);
+}
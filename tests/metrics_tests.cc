@@ -0,0 +1,55 @@
+#include "histogram.hh"
+#include "metrics.hh"
+#include "utilities.hh"
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(METRICS, SUMS_SHARDS_OF_EXITED_THREADS) {
+  auto before = Metrics::totals();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([]() {
+      for (int i = 0; i < 1000; i++)
+        Metrics::packet_in(static_cast<uint32_t>(CH_MESSAGE), 20);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  auto after = Metrics::totals();
+  auto type = static_cast<uint32_t>(CH_MESSAGE);
+  EXPECT_EQ(after.packets_in[type] - before.packets_in[type], 4000u);
+  EXPECT_EQ(after[COUNTER::BYTES_IN] - before[COUNTER::BYTES_IN], 80000u);
+}
+
+TEST(METRICS, RENDERS_PACKETS_BY_TYPE) {
+  Metrics::packet_out(static_cast<uint32_t>(CH_JOIN), 30);
+  Metrics::count(COUNTER::SEND_FAILURES);
+
+  auto text = Metrics::render();
+  EXPECT_NE(text.find("relay_packets_out_total{type=\"CH_JOIN\"}"),
+            std::string::npos);
+  EXPECT_NE(text.find("relay_send_failures_total "), std::string::npos);
+  EXPECT_NE(text.find("relay_thread_pool_queue_depth "), std::string::npos);
+}
+
+TEST(METRICS, STAGE_PERCENTILES_STAY_WITHIN_A_BUCKET) {
+  // other tests record SEND samples too, only look at this test's
+  auto before = Metrics::totals();
+  for (int64_t ns = 1; ns <= 1000; ns++)
+    Metrics::record(STAGE::SEND, 0, ns * 1000);
+  auto after = Metrics::totals();
+
+  Histogram send;
+  for (size_t i = 0; i < HistogramBuckets::COUNT; i++)
+    send.add(i, after[STAGE::SEND].bucket(i) - before[STAGE::SEND].bucket(i));
+  send.add_sum(after[STAGE::SEND].sum() - before[STAGE::SEND].sum(),
+               after[STAGE::SEND].max());
+
+  EXPECT_EQ(send.count(), 1000u);
+  EXPECT_NEAR(send.percentile(0.5), 500'000.0, 500'000 * 0.04);
+  EXPECT_NEAR(send.percentile(0.99), 990'000.0, 990'000 * 0.04);
+  EXPECT_GE(send.max(), 1'000'000u);
+}
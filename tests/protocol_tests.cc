@@ -1,5 +1,7 @@
 #include "utilities.hh"
+#include <cstring>
 #include <gtest/gtest.h>
+#include <string>
 #include <vector>
 
 TEST(REQ_RES_CONSTRUCTOR, REQUEST_CONSTRUCTOR) {
@@ -9,3 +11,205 @@ TEST(REQ_RES_CONSTRUCTOR, REQUEST_CONSTRUCTOR) {
   EXPECT_EQ(request.id, 1);
   EXPECT_EQ(request.type, 22);
 }
+
+TEST(REQ_RES_CONSTRUCTOR, PAYLOAD_VIEWS_THE_FRAME) {
+  std::vector<uint8_t> bytes = {0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+                                0x00, 'b',  'n',  '\n', 'u',  'y',  0x00,
+                                0x00};
+  Request request(bytes);
+  EXPECT_EQ(request.payload.data(), bytes.data() + 8);
+
+  auto parts = split(as_text(request.payload), '\n');
+  ASSERT_EQ(parts.size(), 2);
+  EXPECT_EQ(parts[0], "bn");
+  EXPECT_EQ(parts[1], "uy");
+}
+
+static void push_frame(RingBuffer &input, uint32_t type,
+                       const std::string &payload) {
+  std::vector<uint8_t> bytes;
+  uint32_t size = payload.size() + MIN_FRAME_SIZE;
+  int32_t id = 7;
+  bytes.resize(size + 4);
+  std::memcpy(bytes.data(), &size, 4);
+  std::memcpy(bytes.data() + 4, &id, 4);
+  std::memcpy(bytes.data() + 8, &type, 4);
+  std::memcpy(bytes.data() + 12, payload.data(), payload.size());
+
+  size_t written = 0;
+  while (written < bytes.size()) {
+    input.reserve(input.size() + bytes.size() - written);
+    auto region = input.writable()[0];
+    size_t n = std::min(region.size(), bytes.size() - written);
+    std::memcpy(region.data(), bytes.data() + written, n);
+    input.commit(n);
+    written += n;
+  }
+}
+
+TEST(FRAME_PARSER, EXTRACTS_EVERY_FRAME_FROM_ONE_READ) {
+  RingBuffer input(64);
+  std::vector<uint8_t> frame;
+  push_frame(input, 0x12, "hello");
+  push_frame(input, 0x16, "");
+
+  ASSERT_EQ(next_frame(input, frame), FRAMESTATUS::READY);
+  Request first(frame);
+  EXPECT_EQ(first.type, 0x12);
+  EXPECT_EQ(std::string(first.payload.begin(), first.payload.end()), "hello");
+
+  ASSERT_EQ(next_frame(input, frame), FRAMESTATUS::READY);
+  EXPECT_EQ(Request(frame).type, 0x16);
+  EXPECT_EQ(next_frame(input, frame), FRAMESTATUS::PARTIAL);
+  EXPECT_TRUE(input.empty());
+}
+
+TEST(FRAME_PARSER, KEEPS_PARTIAL_FRAMES_ACROSS_THE_WRAP) {
+  RingBuffer input(32);
+  std::vector<uint8_t> frame;
+  // move the head close to the end so the next frame wraps around
+  push_frame(input, 0x12, "0123456789");
+  ASSERT_EQ(next_frame(input, frame), FRAMESTATUS::READY);
+
+  // 12 byte frame: size, id, type and the two trailing bytes
+  uint8_t bytes[16] = {12, 0, 0, 0, 9, 0, 0, 0, 0x12, 0, 0, 0, 'h', 'i', 0, 0};
+  auto regions = input.writable();
+  ASSERT_EQ(regions[0].size(), 8u);
+  std::memcpy(regions[0].data(), bytes, 8);
+  std::memcpy(regions[1].data(), bytes + 8, 2);
+  input.commit(10);
+  EXPECT_EQ(next_frame(input, frame), FRAMESTATUS::PARTIAL);
+  EXPECT_EQ(input.size(), 10u);
+
+  std::memcpy(input.writable()[0].data(), bytes + 10, 6);
+  input.commit(6);
+  ASSERT_EQ(next_frame(input, frame), FRAMESTATUS::READY);
+  Request request(frame);
+  EXPECT_EQ(request.id, 9);
+  EXPECT_EQ(std::string(request.payload.begin(), request.payload.end()),
+            "hi");
+}
+
+TEST(FRAME_PARSER, REJECTS_OVERSIZED_FRAMES) {
+  RingBuffer input(64);
+  std::vector<uint8_t> frame;
+  uint32_t size = MAX_FRAME_SIZE + 1;
+  auto region = input.writable()[0];
+  std::memcpy(region.data(), &size, 4);
+  input.commit(4);
+  EXPECT_EQ(next_frame(input, frame), FRAMESTATUS::INVALID);
+}
+
+TEST(REQ_RES_CONSTRUCTOR, BUNDLE_CARRIES_WHOLE_FRAMES) {
+  std::vector<shared_frame> frames;
+  frames.push_back(share(response(1, CH_MESSAGE, std::string_view("one"))));
+  frames.push_back(share(response(2, CH_MESSAGE, std::string_view("two!"))));
+
+  auto batch = share(bundle(9, CH_MESSAGE_BUNDLE, frames));
+  auto *bytes = reinterpret_cast<const uint8_t *>(batch->data());
+  Request outer(std::span(bytes + 4, batch->size() - 4));
+  EXPECT_EQ(outer.id, 9);
+  EXPECT_EQ(outer.type, (uint32_t)CH_MESSAGE_BUNDLE);
+  ASSERT_EQ(outer.payload.size(), frames[0]->size() + frames[1]->size());
+
+  // the payload reads like a socket carrying the two frames
+  auto rest = outer.payload;
+  for (const char *text : {"one", "two!"}) {
+    uint32_t size;
+    std::memcpy(&size, rest.data(), 4);
+    Request inner(rest.subspan(4, size));
+    EXPECT_EQ(inner.type, (uint32_t)CH_MESSAGE);
+    EXPECT_EQ(as_text(inner.payload), text);
+    rest = rest.subspan(4 + size);
+  }
+  EXPECT_TRUE(rest.empty());
+}
+
+static std::vector<uint8_t> body_of(const shared_frame &frame) {
+  auto *bytes = reinterpret_cast<const uint8_t *>(frame->data());
+  return std::vector<uint8_t>(bytes + 4, bytes + frame->size());
+}
+
+// Encodes to v2 and back, the v1 body has to come back byte for byte.
+static void expect_round_trip(const shared_frame &frame, FROM from) {
+  auto encoded = to_v2(frame, from);
+  EXPECT_EQ(frame_type(encoded, WIRE::V2), frame_type(frame, WIRE::V1));
+
+  std::span<const uint8_t> rest(
+      reinterpret_cast<const uint8_t *>(encoded->data()), encoded->size());
+  uint64_t length;
+  ASSERT_TRUE(read_varint(rest, length));
+  ASSERT_EQ(length, rest.size());
+
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(decode_v2(rest, decoded, from));
+  EXPECT_EQ(decoded, body_of(frame));
+}
+
+static std::string message_payload(std::vector<uint32_t> ids,
+                                   std::string_view text) {
+  std::string payload;
+  for (uint32_t id : ids)
+    payload.append(raw_bytes(id));
+  payload.append(text);
+  return payload;
+}
+
+TEST(WIRE_V2, ROUND_TRIPS_EVERY_DIRECTION) {
+  expect_round_trip(
+      share(response(3, CH_MESSAGE, message_payload({1, 0}, "hi"))),
+      FROM::CLIENT);
+  expect_round_trip(
+      share(response(-1, CH_MESSAGE, message_payload({4, 9, 2}, "hello"))),
+      FROM::SERVER);
+  expect_round_trip(share(response(3, CH_MESSAGE)), FROM::SERVER);
+  expect_round_trip(
+      share(response(1, SVR_CONNECT, std::string_view("user\n2"))),
+      FROM::SERVER);
+
+  std::string batch;
+  for (uint32_t channel : {5u, 5u, 2u}) {
+    uint16_t length = 3;
+    batch.append(raw_bytes(channel));
+    batch.append(raw_bytes(uint32_t{0}));
+    batch.append(raw_bytes(length));
+    batch.append("abc");
+  }
+  expect_round_trip(share(response(8, CH_MESSAGE_BATCH, batch)),
+                    FROM::CLIENT);
+}
+
+TEST(WIRE_V2, PACKS_BUNDLES_SMALLER) {
+  std::vector<shared_frame> frames;
+  for (int32_t seq = 100; seq < 110; seq++)
+    frames.push_back(share(response(
+        seq, CH_MESSAGE, message_payload({7, 1234, 0}, "short text"))));
+  auto frame = share(bundle(110, CH_MESSAGE_BUNDLE, frames));
+
+  expect_round_trip(frame, FROM::SERVER);
+  // 12 bytes of ids and 8 of framing per message go down to a few
+  EXPECT_LT(to_v2(frame, FROM::SERVER)->size() * 2, frame->size());
+}
+
+TEST(WIRE_V2, PARSES_FRAMES_FED_BYTE_BY_BYTE) {
+  auto frame =
+      share(response(3, CH_MESSAGE, message_payload({1, 0}, "hello")));
+  auto encoded = to_v2(frame, FROM::CLIENT);
+
+  RingBuffer input(64);
+  std::vector<uint8_t> decoded;
+  for (size_t i = 0; i < encoded->size(); i++) {
+    EXPECT_EQ(next_frame(input, decoded, WIRE::V2), FRAMESTATUS::PARTIAL);
+    *input.writable()[0].data() = encoded->data()[i];
+    input.commit(1);
+  }
+  ASSERT_EQ(next_frame(input, decoded, WIRE::V2), FRAMESTATUS::READY);
+  EXPECT_EQ(decoded, body_of(frame));
+  EXPECT_TRUE(input.empty());
+
+  // a length past MAX_FRAME_SIZE
+  const uint8_t oversized[3] = {0xFF, 0xFF, 0x7F};
+  std::memcpy(input.writable()[0].data(), oversized, 3);
+  input.commit(3);
+  EXPECT_EQ(next_frame(input, decoded, WIRE::V2), FRAMESTATUS::INVALID);
+}
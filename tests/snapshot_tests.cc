@@ -0,0 +1,63 @@
+#include "managers.hh"
+#include "snapshot.hh"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+static std::vector<ChannelRecord> sample() {
+  return {{900001, false, 12, "lobby", ""},
+          {900002, true, 1, "staff", "be nice"},
+          {900017, false, 4000, std::string(300, 'n'),
+           std::string(70000, 'p')}};
+}
+
+TEST(SNAPSHOT, ROUND_TRIPS_AND_REJECTS_DAMAGE) {
+  auto bytes = Snapshot::encode(sample());
+  auto records = Snapshot::decode(bytes);
+  ASSERT_TRUE(records.has_value());
+  ASSERT_EQ(records->size(), 3u);
+  EXPECT_EQ((*records)[1].name, "staff");
+  EXPECT_TRUE((*records)[1].secret);
+  EXPECT_EQ((*records)[1].pinned, "be nice");
+  EXPECT_EQ((*records)[2].next_seq, 4000);
+  EXPECT_EQ((*records)[2].pinned.size(), 70000u);
+
+  auto flipped = bytes;
+  flipped[20] ^= 1;
+  EXPECT_FALSE(Snapshot::decode(flipped).has_value());
+  EXPECT_FALSE(
+      Snapshot::decode(std::span(bytes).first(bytes.size() - 1)).has_value());
+  EXPECT_FALSE(Snapshot::decode({}).has_value());
+}
+
+TEST(SNAPSHOT, RESTORES_THE_CHANNEL_DIRECTORY) {
+  auto file = std::filesystem::temp_directory_path() / "relay-test.snap";
+  ASSERT_TRUE(Snapshot::write(file, Snapshot::encode(sample())));
+  auto records = Snapshot::read(file);
+  std::filesystem::remove(file);
+  ASSERT_TRUE(records.has_value());
+
+  auto &channels = ChannelManager::instance();
+  EXPECT_EQ(channels.restore(*records), 3u);
+  // a second restore doesn't replace live channels
+  EXPECT_EQ(channels.restore(*records), 0u);
+
+  auto staff = channels.find_channel(900002);
+  ASSERT_NE(staff, nullptr);
+  EXPECT_EQ(staff->name, "staff");
+  EXPECT_TRUE(staff->secret);
+  EXPECT_EQ(staff->pinnedMessage, "be nice");
+  EXPECT_EQ(channels.find_channel(900017)->packetIds.load(), 4000);
+
+  // new channels don't take a restored id
+  auto info = channels.create_channel("after", false);
+  uint32_t id;
+  std::memcpy(&id, info.data(), 4);
+  EXPECT_GT(id, 900017u);
+
+  for (uint32_t restored : {900001u, 900002u, 900017u, id})
+    channels.remove_channel(restored);
+}
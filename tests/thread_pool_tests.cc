@@ -0,0 +1,65 @@
+#include "thread_pool.hh"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(THREAD_POOL, RUNS_EVERY_TASK_BEFORE_SHUTDOWN) {
+  std::atomic_int done{0};
+  {
+    ThreadPool pool(4);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; p++) {
+      producers.emplace_back([&pool, &done]() {
+        for (int i = 0; i < 10000; i++) {
+          pool.enqueue([&done]() { done.fetch_add(1); });
+        }
+      });
+    }
+    for (auto &producer : producers) {
+      producer.join();
+    }
+  }
+  EXPECT_EQ(done.load(), 40000);
+}
+
+TEST(THREAD_POOL, WORKERS_ENQUEUE_ON_THEIR_OWN_DEQUE) {
+  std::atomic_int done{0};
+  {
+    ThreadPool pool(2);
+    pool.enqueue([&pool, &done]() {
+      for (int i = 0; i < 1000; i++) {
+        pool.enqueue([&done]() { done.fetch_add(1); });
+      }
+    });
+  }
+  EXPECT_EQ(done.load(), 1000);
+}
+
+TEST(THREAD_POOL, A_WORKER_RUNS_WHAT_NO_QUEUE_HAS_ROOM_FOR) {
+  // more than its deque and the injection queue hold, with no other worker
+  // to drain them
+  std::atomic_int done{0};
+  {
+    ThreadPool pool(1);
+    pool.enqueue([&pool, &done]() {
+      for (int i = 0; i < 20000; i++) {
+        pool.enqueue([&done]() { done.fetch_add(1); });
+      }
+    });
+  }
+  EXPECT_EQ(done.load(), 20000);
+}
+
+TEST(THREAD_POOL, TASKS_RELEASE_THEIR_CAPTURES) {
+  auto shared = std::make_shared<std::atomic_int>(0);
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 100; i++) {
+      pool.enqueue([shared]() { shared->fetch_add(1); });
+    }
+  }
+  EXPECT_EQ(shared->load(), 100);
+  EXPECT_EQ(shared.use_count(), 1);
+}
@@ -0,0 +1,900 @@
+#include "histogram.hh"
+#include "utilities.hh"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/* End to end load generator for the relay.
+ *
+ * Opens `clients` loopback connections (a share of them over WebSocket),
+ * connects and joins every client to `joins` of the channels created for the
+ * run, then sends CH_MESSAGE at a fixed aggregate rate. Every message carries
+ * its send time, so each delivery to a channel member yields one end to end
+ * latency sample.
+ *
+ * Counting is done over a measurement window that follows a warmup: sends
+ * and deliveries are counted by their send time, so messages still in flight
+ * when the window closes are waited for rather than dropped.
+ */
+
+namespace {
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 3000;
+  int ws_port = 8081;
+  int clients = 1000;
+  // share of the clients connecting over WebSocket
+  double websocket = 0.0;
+  int channels = 20;
+  // channels every client joins
+  int joins = 1;
+  // the server's channel capacity (its --members)
+  int members = 50;
+  // share of the messages sent to the first channel
+  double hot = 0.0;
+  // CH_MESSAGE per second, all clients together
+  int rate = 1000;
+  int size = 64;
+  // messages per request, above 1 they go out as CH_MESSAGE_BATCH
+  int batch = 1;
+  int threads = 4;
+  int warmup = 2;
+  int duration = 10;
+  std::string password = "password";
+  // wire format the clients ask for, the admin session stays on v1
+  int wire = 1;
+};
+
+// A client whose unsent bytes exceed this skips its turn instead.
+constexpr size_t MAX_BACKLOG = 1 << 20;
+// How long in flight messages get after the window closes.
+constexpr auto DRAIN_TIME = std::chrono::seconds(2);
+constexpr auto SETUP_TIMEOUT = std::chrono::seconds(60);
+
+std::atomic_int ready_clients{0};
+std::atomic_bool sending{false};
+std::atomic_bool stopping{false};
+std::atomic_int64_t window_start{std::numeric_limits<int64_t>::max()};
+std::atomic_int64_t window_end{std::numeric_limits<int64_t>::max()};
+
+inline int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline bool in_window(int64_t stamp) {
+  return stamp >= window_start.load(std::memory_order_relaxed) &&
+         stamp < window_end.load(std::memory_order_relaxed);
+}
+
+struct Counters {
+  uint64_t sent{0};
+  uint64_t acked{0};
+  uint64_t rejected{0};
+  uint64_t delivered{0};
+  uint64_t throttled{0};
+  uint64_t join_failures{0};
+  uint64_t disconnects{0};
+
+  void merge(const Counters &other) {
+    this->sent += other.sent;
+    this->acked += other.acked;
+    this->rejected += other.rejected;
+    this->delivered += other.delivered;
+    this->throttled += other.throttled;
+    this->join_failures += other.join_failures;
+    this->disconnects += other.disconnects;
+  }
+};
+
+int connect_to(const std::string &host, int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr(host.c_str());
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return fd;
+}
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Blocking read of one frame body (everything after the size prefix).
+std::optional<std::vector<uint8_t>> read_frame(int fd) {
+  auto read_exact = [fd](uint8_t *out, size_t size) {
+    while (size > 0) {
+      ssize_t n = recv(fd, out, size, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      out += n;
+      size -= n;
+    }
+    return true;
+  };
+
+  uint8_t header[4];
+  if (!read_exact(header, 4))
+    return std::nullopt;
+  uint32_t size = i32_from_le(header);
+  if (size < MIN_FRAME_SIZE || size > MAX_FRAME_SIZE)
+    return std::nullopt;
+  std::vector<uint8_t> body(size);
+  if (!read_exact(body.data(), size))
+    return std::nullopt;
+  return body;
+}
+
+/* Connects an admin session and creates the channels for the run. The
+ * session is kept open (returned through `admin_fd`) until the run ends.
+ */
+std::vector<uint32_t> create_channels(const Options &options, int &admin_fd) {
+  admin_fd = connect_to(options.host, options.port);
+  if (admin_fd == -1)
+    throw std::runtime_error(
+        std::format("could not connect to {}:{}", options.host, options.port));
+
+  auto send_request = [&](PACKET_TYPE type, std::string_view payload) {
+    auto frame = share(response(1, type, payload));
+    if (!write_all(admin_fd, frame->data(), frame->size()))
+      throw std::runtime_error("admin session closed");
+  };
+  auto reply_to = [&](PACKET_TYPE type) {
+    while (true) {
+      auto body = read_frame(admin_fd);
+      if (!body)
+        throw std::runtime_error("admin session closed");
+      Request reply(*body);
+      if (type == reply.type)
+        return std::make_pair(reply.id, std::vector<uint8_t>(
+                                            reply.payload.begin(),
+                                            reply.payload.end()));
+    }
+  };
+
+  send_request(SVR_CONNECT, "loadgen\n" + options.password);
+  reply_to(SVR_CONNECT);
+
+  std::vector<uint32_t> ids;
+  for (int i = 0; i < options.channels; i++) {
+    std::string payload = std::format("{:c}loadgen-{}", '\0', i);
+    send_request(CH_CREATE, payload);
+    auto [id, info] = reply_to(CH_CREATE);
+    if (id == -1 || info.size() < 4)
+      throw std::runtime_error("CH_CREATE rejected, is --password right?");
+    ids.push_back(i32_from_le(info));
+  }
+  return ids;
+}
+
+enum class PHASE { HANDSHAKE, CONNECTING, JOINING, READY, CLOSED };
+
+struct Connection {
+  int fd{-1};
+  bool websocket{false};
+  PHASE phase{PHASE::CONNECTING};
+  std::vector<uint32_t> channels{};
+  // channels the server accepted the join for
+  std::vector<uint32_t> joined{};
+  size_t join_replies{0};
+  // the server switched the session to wire format v2
+  bool v2{false};
+  bool want_write{false};
+  std::vector<uint8_t> input{};
+  std::vector<uint8_t> output{};
+  size_t out_offset{0};
+};
+
+/* Drives a slice of the clients from its own epoll loop, and sends its share
+ * of the message rate from those clients.
+ */
+class Worker {
+private:
+  const Options &options_;
+  const std::vector<uint32_t> &channels_;
+  int epoll_fd_{-1};
+  std::vector<Connection> connections_{};
+  // clients that finished joining, and those among them in the hot channel
+  std::vector<size_t> ready_{};
+  std::vector<size_t> hot_{};
+  std::mt19937_64 rng_;
+  int32_t next_id_{1};
+  std::string message_;
+  // v2 frames are read decoded to v1 in here
+  std::vector<uint8_t> decoded_{};
+
+  void queue(Connection &conn, std::string_view bytes);
+  void queue_request(Connection &conn, PACKET_TYPE type,
+                     std::string_view payload);
+  void queue_connect(Connection &conn, std::string_view username);
+  void flush(Connection &conn);
+  void close_connection(Connection &conn);
+
+  void on_readable(size_t index);
+  bool on_handshake(Connection &conn);
+  void on_frame(size_t index, const Request &request);
+  void became_ready(size_t index);
+
+  void send_message();
+
+public:
+  Histogram latency;
+  Counters counters;
+
+  Worker(const Options &options, const std::vector<uint32_t> &channels,
+         int seed)
+      : options_(options), channels_(channels), rng_(seed),
+        message_(std::max(options.size, 8), 'x') {}
+  ~Worker() { close(this->epoll_fd_); }
+
+  void open(int first, int last);
+  void run();
+};
+
+void Worker::queue(Connection &conn, std::string_view bytes) {
+  conn.output.insert(conn.output.end(), bytes.begin(), bytes.end());
+}
+
+/* Encodes a request, WebSocket clients wrap it in a masked binary message.
+ */
+void Worker::queue_request(Connection &conn, PACKET_TYPE type,
+                           std::string_view payload) {
+  auto frame = share(response(this->next_id_++, type, payload));
+  if (conn.v2)
+    frame = to_v2(frame, FROM::CLIENT);
+  std::string_view bytes(frame->data(), frame->size());
+  if (!conn.websocket) {
+    this->queue(conn, bytes);
+    return;
+  }
+
+  uint8_t header[14] = {0x82};
+  size_t length = 2;
+  if (bytes.size() < 126) {
+    header[1] = 0x80 | bytes.size();
+  } else if (bytes.size() <= 0xFFFF) {
+    header[1] = 0x80 | 126;
+    header[2] = bytes.size() >> 8;
+    header[3] = bytes.size() & 0xFF;
+    length = 4;
+  } else {
+    header[1] = 0x80 | 127;
+    for (int b = 0; b < 8; b++)
+      header[2 + b] = static_cast<uint64_t>(bytes.size()) >> (56 - 8 * b);
+    length = 10;
+  }
+  uint32_t mask = this->rng_();
+  std::memcpy(header + length, &mask, 4);
+  length += 4;
+  this->queue(conn, std::string_view((char *)header, length));
+
+  size_t start = conn.output.size();
+  this->queue(conn, bytes);
+  for (size_t i = 0; i < bytes.size(); i++)
+    conn.output[start + i] ^= header[length - 4 + i % 4];
+}
+
+// The SVR_CONNECT request, asking for v2 when --wire=2.
+void Worker::queue_connect(Connection &conn, std::string_view username) {
+  std::string payload(username);
+  if (this->options_.wire == 2)
+    payload += "\n\n2";
+  this->queue_request(conn, SVR_CONNECT, payload);
+}
+
+void Worker::flush(Connection &conn) {
+  while (conn.out_offset < conn.output.size()) {
+    ssize_t n = send(conn.fd, conn.output.data() + conn.out_offset,
+                     conn.output.size() - conn.out_offset, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        this->close_connection(conn);
+        return;
+      }
+      break;
+    }
+    conn.out_offset += n;
+  }
+
+  bool pending = conn.out_offset < conn.output.size();
+  if (!pending) {
+    conn.output.clear();
+    conn.out_offset = 0;
+  }
+  if (pending != conn.want_write) {
+    conn.want_write = pending;
+    epoll_event ev{};
+    ev.events = EPOLLIN | (pending ? (uint32_t)EPOLLOUT : 0);
+    ev.data.u64 = &conn - this->connections_.data();
+    epoll_ctl(this->epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev);
+  }
+}
+
+void Worker::close_connection(Connection &conn) {
+  if (conn.phase == PHASE::CLOSED)
+    return;
+  if (conn.phase != PHASE::READY)
+    ready_clients.fetch_add(1);
+  conn.phase = PHASE::CLOSED;
+  close(conn.fd);
+  this->counters.disconnects++;
+}
+
+/* Connects clients [first, last), client i joins channels i*joins onwards
+ * (modulo the channel count) so members spread evenly.
+ */
+void Worker::open(int first, int last) {
+  this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  this->connections_.resize(last - first);
+
+  int websockets = this->options_.websocket * this->options_.clients;
+  for (int i = first; i < last; i++) {
+    auto &conn = this->connections_[i - first];
+    for (int k = 0; k < this->options_.joins; k++) {
+      auto channel = (i * this->options_.joins + k) % this->channels_.size();
+      conn.channels.push_back(this->channels_[channel]);
+    }
+
+    conn.websocket = i < websockets;
+    conn.fd = connect_to(this->options_.host, conn.websocket
+                                                  ? this->options_.ws_port
+                                                  : this->options_.port);
+    if (conn.fd == -1) {
+      conn.phase = PHASE::CLOSED;
+      ready_clients.fetch_add(1);
+      this->counters.disconnects++;
+      continue;
+    }
+
+    fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL) | O_NONBLOCK);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = i - first;
+    epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, conn.fd, &ev);
+
+    if (conn.websocket) {
+      conn.phase = PHASE::HANDSHAKE;
+      this->queue(conn, std::format("GET / HTTP/1.1\r\n"
+                                    "Host: {}:{}\r\n"
+                                    "Upgrade: websocket\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Sec-WebSocket-Key: {}\r\n"
+                                    "Sec-WebSocket-Version: 13\r\n\r\n",
+                                    this->options_.host,
+                                    this->options_.ws_port,
+                                    "dGhlIHNhbXBsZSBub25jZQ=="));
+    } else {
+      this->queue_connect(conn, std::format("loadgen{}", i));
+    }
+    this->flush(conn);
+  }
+}
+
+/* Waits for the server's 101 reply, anything after it is already framed.
+ */
+bool Worker::on_handshake(Connection &conn) {
+  std::string_view text((char *)conn.input.data(), conn.input.size());
+  auto end = text.find("\r\n\r\n");
+  if (end == std::string_view::npos)
+    return true;
+  if (!text.starts_with("HTTP/1.1 101"))
+    return false;
+
+  conn.input.erase(conn.input.begin(), conn.input.begin() + end + 4);
+  conn.phase = PHASE::CONNECTING;
+  auto index = &conn - this->connections_.data();
+  this->queue_connect(conn, std::format("loadgen-ws{}", index));
+  this->flush(conn);
+  return true;
+}
+
+void Worker::on_readable(size_t index) {
+  auto &conn = this->connections_[index];
+  uint8_t chunk[64 * 1024];
+  while (true) {
+    ssize_t n = recv(conn.fd, chunk, sizeof(chunk), 0);
+    if (n > 0) {
+      conn.input.insert(conn.input.end(), chunk, chunk + n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    this->close_connection(conn);
+    return;
+  }
+
+  if (conn.phase == PHASE::HANDSHAKE && !this->on_handshake(conn)) {
+    this->close_connection(conn);
+    return;
+  }
+  if (conn.phase == PHASE::HANDSHAKE)
+    return;
+
+  // relay frames are size prefixed, on WebSocket each one is a message.
+  // `frame` is the encoded body, v2 bodies are decoded before on_frame.
+  std::span<const uint8_t> input(conn.input);
+  size_t consumed = 0;
+  while (conn.phase != PHASE::CLOSED) {
+    auto rest = input.subspan(consumed);
+    std::span<const uint8_t> frame;
+    if (conn.websocket) {
+      if (rest.size() < 2)
+        break;
+      uint8_t opcode = rest[0] & 0x0F;
+      size_t length = rest[1] & 0x7F;
+      size_t header = 2;
+      if (length == 126) {
+        if (rest.size() < 4)
+          break;
+        length = rest[2] << 8 | rest[3];
+        header = 4;
+      } else if (length == 127) {
+        if (rest.size() < 10)
+          break;
+        length = 0;
+        for (int b = 2; b < 10; b++)
+          length = length << 8 | rest[b];
+        header = 10;
+      }
+      if (rest.size() < header + length)
+        break;
+      consumed += header + length;
+      if (opcode == 0x8) {
+        this->close_connection(conn);
+        break;
+      }
+      if (opcode != 0x2)
+        continue;
+      frame = rest.subspan(header, length);
+      if (!conn.v2) {
+        if (length < 4 + MIN_FRAME_SIZE)
+          continue;
+        frame = frame.subspan(4);
+      } else {
+        uint64_t size;
+        if (!read_varint(frame, size) || size != frame.size())
+          continue;
+      }
+    } else if (conn.v2) {
+      auto body = rest;
+      uint64_t size;
+      if (!read_varint(body, size) && rest.size() < 3)
+        break;
+      if (body.size() == rest.size() || size < 2 || size > MAX_FRAME_SIZE) {
+        this->close_connection(conn);
+        break;
+      }
+      if (body.size() < size)
+        break;
+      consumed += rest.size() - body.size() + size;
+      frame = body.first(size);
+    } else {
+      if (rest.size() < 4)
+        break;
+      uint32_t size = i32_from_le(rest);
+      if (size < MIN_FRAME_SIZE || size > MAX_FRAME_SIZE) {
+        this->close_connection(conn);
+        break;
+      }
+      if (rest.size() < size + 4)
+        break;
+      consumed += size + 4;
+      frame = rest.subspan(4, size);
+    }
+    if (conn.v2) {
+      if (!decode_v2(frame, this->decoded_, FROM::SERVER)) {
+        this->close_connection(conn);
+        break;
+      }
+      frame = this->decoded_;
+    }
+    this->on_frame(index, Request(frame));
+  }
+
+  if (conn.phase != PHASE::CLOSED)
+    conn.input.erase(conn.input.begin(), conn.input.begin() + consumed);
+}
+
+void Worker::on_frame(size_t index, const Request &request) {
+  auto &conn = this->connections_[index];
+  switch (request.type) {
+  case (uint32_t)SVR_CONNECT:
+    if (request.id == -1) {
+      this->close_connection(conn);
+      return;
+    }
+    conn.phase = PHASE::JOINING;
+    conn.v2 = as_text(request.payload).ends_with("\n2");
+    for (uint32_t channel : conn.channels)
+      this->queue_request(conn, CH_JOIN, raw_bytes(channel));
+    this->flush(conn);
+    return;
+  case (uint32_t)CH_JOIN:
+    // a successful reply carries the channel info, its id first
+    if (request.id != -1 && request.payload.size() >= 4)
+      conn.joined.push_back(i32_from_le(request.payload));
+    else
+      this->counters.join_failures++;
+    if (++conn.join_replies == conn.channels.size())
+      this->became_ready(index);
+    return;
+  case (uint32_t)CH_MESSAGE:
+    break;
+  case (uint32_t)CH_MESSAGE_BATCH:
+    // one status byte per message of the batch
+    if (!in_window(now_ns()))
+      return;
+    if (request.id == -1) {
+      this->counters.rejected += this->options_.batch;
+      return;
+    }
+    for (uint8_t status : request.payload) {
+      if (status == 1)
+        this->counters.acked++;
+      else
+        this->counters.rejected++;
+    }
+    return;
+  case (uint32_t)CH_MESSAGE_BUNDLE: {
+    // pending broadcasts, whole frames back to back
+    auto rest = request.payload;
+    while (rest.size() >= 4 + MIN_FRAME_SIZE) {
+      uint32_t size;
+      std::memcpy(&size, rest.data(), 4);
+      if (size < MIN_FRAME_SIZE || rest.size() < size + 4)
+        return;
+      this->on_frame(index, Request(rest.subspan(4, size)));
+      rest = rest.subspan(4 + size);
+    }
+    return;
+  }
+  default:
+    return;
+  }
+
+  // broadcasts carry channel, sender and reply-to ids, acks carry nothing
+  auto payload = request.payload;
+  if (payload.size() < 12) {
+    if (!in_window(now_ns()))
+      return;
+    if (request.id == -1)
+      this->counters.rejected++;
+    else
+      this->counters.acked++;
+    return;
+  }
+
+  auto message = payload.subspan(12);
+  if (message.size() < 8)
+    return;
+  int64_t stamp;
+  std::memcpy(&stamp, message.data(), 8);
+  if (!in_window(stamp))
+    return;
+  this->counters.delivered++;
+  this->latency.record(now_ns() - stamp);
+}
+
+void Worker::became_ready(size_t index) {
+  auto &conn = this->connections_[index];
+  conn.phase = PHASE::READY;
+  ready_clients.fetch_add(1);
+  if (conn.joined.empty())
+    return;
+
+  this->ready_.push_back(index);
+  if (std::find(conn.joined.begin(), conn.joined.end(), this->channels_[0]) !=
+      conn.joined.end())
+    this->hot_.push_back(index);
+}
+
+/* Sends one stamped CH_MESSAGE (or a CH_MESSAGE_BATCH of `batch` of them)
+ * from a random ready client, to the hot channel `hot` of the time.
+ */
+void Worker::send_message() {
+  std::uniform_real_distribution<double> coin(0.0, 1.0);
+  bool hot = !this->hot_.empty() && coin(this->rng_) < this->options_.hot;
+  auto &pool = hot ? this->hot_ : this->ready_;
+  auto &conn = this->connections_[pool[this->rng_() % pool.size()]];
+  if (conn.phase != PHASE::READY)
+    return;
+  if (conn.output.size() - conn.out_offset > MAX_BACKLOG) {
+    this->counters.throttled++;
+    return;
+  }
+
+  uint32_t channel = hot ? this->channels_[0]
+                         : conn.joined[this->rng_() % conn.joined.size()];
+  uint32_t reply_to = 0;
+  int64_t stamp = now_ns();
+  std::memcpy(this->message_.data(), &stamp, 8);
+
+  std::string payload;
+  if (this->options_.batch == 1) {
+    payload.reserve(8 + this->message_.size());
+    payload.append(raw_bytes(channel));
+    payload.append(raw_bytes(reply_to));
+    payload.append(this->message_);
+    this->queue_request(conn, CH_MESSAGE, payload);
+  } else {
+    uint16_t length = this->message_.size();
+    payload.reserve(this->options_.batch * (10 + this->message_.size()));
+    for (int k = 0; k < this->options_.batch; k++) {
+      payload.append(raw_bytes(channel));
+      payload.append(raw_bytes(reply_to));
+      payload.append(raw_bytes(length));
+      payload.append(this->message_);
+    }
+    this->queue_request(conn, CH_MESSAGE_BATCH, payload);
+  }
+  this->flush(conn);
+  if (in_window(stamp))
+    this->counters.sent += this->options_.batch;
+}
+
+/* Open loop pacing: whatever fell due since the last turn is sent, so a
+ * slow server shows up as latency rather than as a lower send rate.
+ */
+void Worker::run() {
+  constexpr int MAX_EVENTS = 256;
+  constexpr int64_t MAX_BURST = 1024;
+  epoll_event events[MAX_EVENTS];
+  double per_ns = this->options_.rate / 1e9 / this->options_.batch /
+                  std::max(1, this->options_.threads);
+  int64_t started = 0;
+  int64_t issued = 0;
+
+  while (!stopping.load(std::memory_order_relaxed)) {
+    int n = epoll_wait(this->epoll_fd_, events, MAX_EVENTS, 1);
+    for (int i = 0; i < n; i++) {
+      auto index = events[i].data.u64;
+      auto &conn = this->connections_[index];
+      if (conn.phase == PHASE::CLOSED)
+        continue;
+      if (events[i].events & EPOLLOUT)
+        this->flush(conn);
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        this->on_readable(index);
+    }
+
+    if (!sending.load(std::memory_order_relaxed) || this->ready_.empty()) {
+      started = 0;
+      continue;
+    }
+    int64_t now = now_ns();
+    if (started == 0) {
+      started = now;
+      issued = 0;
+    }
+    int64_t due = (now - started) * per_ns - issued;
+    for (int64_t k = 0; k < std::min(due, MAX_BURST); k++, issued++)
+      this->send_message();
+  }
+
+  for (auto &conn : this->connections_) {
+    if (conn.phase != PHASE::CLOSED)
+      close(conn.fd);
+  }
+}
+
+std::optional<std::string> value_of(const std::string &arg,
+                                    std::string_view name) {
+  if (arg.rfind(name, 0) != 0)
+    return std::nullopt;
+  return arg.substr(name.size());
+}
+
+Options parse_options(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (auto v = value_of(arg, "--host=")) {
+      options.host = *v;
+    } else if (auto v = value_of(arg, "--port=")) {
+      options.port = std::stoi(*v);
+    } else if (auto v = value_of(arg, "--ws-port=")) {
+      options.ws_port = std::stoi(*v);
+    } else if (auto v = value_of(arg, "--clients=")) {
+      options.clients = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--websocket=")) {
+      options.websocket = std::clamp(std::stod(*v), 0.0, 1.0);
+    } else if (auto v = value_of(arg, "--channels=")) {
+      options.channels = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--joins=")) {
+      options.joins = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--members=")) {
+      options.members = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--hot=")) {
+      options.hot = std::clamp(std::stod(*v), 0.0, 1.0);
+    } else if (auto v = value_of(arg, "--rate=")) {
+      options.rate = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--size=")) {
+      options.size = std::clamp(std::stoi(*v), 8, 32 * 1024);
+    } else if (auto v = value_of(arg, "--batch=")) {
+      options.batch = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--threads=")) {
+      options.threads = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--warmup=")) {
+      options.warmup = std::max(0, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--duration=")) {
+      options.duration = std::max(1, std::stoi(*v));
+    } else if (auto v = value_of(arg, "--password=")) {
+      options.password = *v;
+    } else if (auto v = value_of(arg, "--wire=")) {
+      options.wire = std::clamp(std::stoi(*v), 1, 2);
+    } else {
+      throw std::invalid_argument(arg);
+    }
+  }
+  options.joins = std::min(options.joins, options.channels);
+  // a batch has to fit in one frame
+  options.batch = std::min<int>(
+      options.batch, (MAX_FRAME_SIZE - MIN_FRAME_SIZE) / (options.size + 10));
+  options.threads = std::min(options.threads, options.clients);
+  return options;
+}
+
+std::string format_ns(uint64_t ns) {
+  if (ns < 10'000)
+    return std::format("{}ns", ns);
+  if (ns < 10'000'000)
+    return std::format("{}us", ns / 1000);
+  return std::format("{}ms", ns / 1'000'000);
+}
+
+} // namespace
+
+/* Args
+ * --host=127.0.0.1 --port=3000 --ws-port=8081
+ * --clients=1000 --websocket=0.0 (share over WebSocket)
+ * --channels=20 --joins=1 --hot=0.0 (share of messages to channel 0)
+ * --members=50 (the server's channel capacity, only used for a warning)
+ * --rate=1000 (messages per second) --size=64 (message bytes)
+ * --batch=1 (messages per request, above 1 sent as CH_MESSAGE_BATCH)
+ * --threads=4 --warmup=2 --duration=10 (seconds)
+ * --password=password (admin password, channels are created for the run)
+ * --wire=1 (wire format the clients negotiate, 1 or 2)
+ */
+int main(int argc, char *argv[]) {
+  Options options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << "invalid argument: " << e.what() << std::endl;
+    return 1;
+  }
+
+  // every client is a socket, lift the descriptor limit as far as allowed
+  rlimit limit{};
+  getrlimit(RLIMIT_NOFILE, &limit);
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+
+  if (options.clients * options.joins > options.channels * options.members) {
+    std::cerr << std::format("warning: {} joins over {} channels of {} "
+                             "members, some joins will fail\n",
+                             options.clients * options.joins,
+                             options.channels, options.members);
+  }
+
+  int admin_fd = -1;
+  std::vector<uint32_t> channels;
+  try {
+    channels = create_channels(options, admin_fd);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  auto setup_start = std::chrono::steady_clock::now();
+  for (int t = 0; t < options.threads; t++) {
+    int first = (int64_t)options.clients * t / options.threads;
+    int last = (int64_t)options.clients * (t + 1) / options.threads;
+    workers.push_back(std::make_unique<Worker>(options, channels, t + 1));
+    threads.emplace_back([&worker = *workers.back(), first, last]() {
+      worker.open(first, last);
+      worker.run();
+    });
+  }
+
+  while (ready_clients.load() < options.clients &&
+         std::chrono::steady_clock::now() - setup_start < SETUP_TIMEOUT)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::chrono::duration<double> setup_time =
+      std::chrono::steady_clock::now() - setup_start;
+
+  sending.store(true);
+  std::this_thread::sleep_for(std::chrono::seconds(options.warmup));
+  window_start.store(now_ns());
+  std::this_thread::sleep_for(std::chrono::seconds(options.duration));
+  window_end.store(now_ns());
+  sending.store(false);
+  std::this_thread::sleep_for(DRAIN_TIME);
+  stopping.store(true);
+
+  for (auto &thread : threads)
+    thread.join();
+  close(admin_fd);
+
+  Counters total;
+  Histogram latency;
+  for (auto &worker : workers) {
+    total.merge(worker->counters);
+    latency.merge(worker->latency);
+  }
+
+  double seconds = (window_end.load() - window_start.load()) / 1e9;
+  int websockets = options.websocket * options.clients;
+  std::cout << std::format(
+      "clients     {} ({} tcp, {} websocket), {} ready in {:.2f}s\n"
+      "channels    {}, {} joined per client, {} joins failed\n"
+      "target      {} msg/s, {} byte messages, hot share {:.2f}\n"
+      "window      {:.1f}s after {}s warmup\n"
+      "sent        {:.0f} msg/s\n"
+      "acked       {:.0f} msg/s ({} rejected)\n"
+      "delivered   {:.0f} msg/s (fan-out {:.1f})\n"
+      "latency     p50 {}  p99 {}  p999 {}  max {}\n"
+      "throttled   {}, disconnects {}\n",
+      options.clients, options.clients - websockets, websockets,
+      ready_clients.load(), setup_time.count(), options.channels,
+      options.joins, total.join_failures, options.rate, options.size,
+      options.hot, seconds, options.warmup, total.sent / seconds,
+      total.acked / seconds, total.rejected, total.delivered / seconds,
+      total.sent > 0 ? (double)total.delivered / total.sent : 0.0,
+      format_ns(latency.percentile(0.5)), format_ns(latency.percentile(0.99)),
+      format_ns(latency.percentile(0.999)), format_ns(latency.max()),
+      total.throttled, total.disconnects);
+  return 0;
+}